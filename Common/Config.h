@@ -12,15 +12,42 @@
 #endif
 #endif
 
+#define TLS_SESSION_TICKETS 1
+#define TLS_CIPHERS "ECDHE+AESGCM:ECDHE+CHACHA20:ECDHE+AES:DHE+AESGCM:!aNULL:!eNULL:!MD5:!RC4:!3DES"
+#define TLS_CURVES "X25519:P-256:P-384"
+
 // #define USE_PG_CONFIG 1
 #define USE_FILE_CONFIG 1
 
 enum {
     UPDATE_CERTIFICATE_TIMEOUT = 24 * 60, // minutes
+    CONFIG_CHECK_INTERVAL = 5, // seconds
+};
+
+enum {
+    TLS_SESSION_CACHE_SIZE = 20 * 1024, // sessions
+    TLS_SESSION_TIMEOUT = 2 * 60 * 60, // seconds
+    // ticket key is kept for two rotation intervals (as current and previous one),
+    // so it shouldn't be shorter than half of session timeout
+    TLS_TICKET_KEYS_ROTATION_INTERVAL = TLS_SESSION_TIMEOUT / 2, // seconds
+};
+
+enum {
+    HEARTBEAT_INTERVAL = 15, // seconds
+    HEARTBEAT_MAX_MISSED = 3,
+};
+
+enum {
+    DEFAULT_STREAM_LINGER = 10, // seconds
+};
+
+enum {
+    CONTROL_SERVER_SHARDS_COUNT = 0, // 0 - one shard per CPU core
 };
 
 enum {
     DEFAULT_CONTROL_SERVER_PORT = 8000,
     DEFAULT_STATIC_SERVER_PORT = 8090,
     DEFAULT_RESTREAM_SERVER_PORT = 8100,
+    DEFAULT_SNAPSHOT_SERVER_PORT = 8110,
 };
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <utility>
+
+
+// size bounded least recently used cache with limited entries lifetime
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    inline LruCache(size_t maxSize, Clock::duration ttl);
+
+    size_t size() const
+        { return _index.size(); }
+    bool empty() const
+        { return _index.empty(); }
+
+    // returns nullptr if there is no entry or it's expired
+    inline const Value* find(const Key&);
+
+    inline void put(const Key&, const Value&);
+    inline void erase(const Key&);
+    inline void clear();
+
+private:
+    struct Entry
+    {
+        Key key;
+        Value value;
+        Clock::time_point expiresAt;
+    };
+
+    typedef std::list<Entry> Entries;
+
+    const size_t _maxSize;
+    const Clock::duration _ttl;
+
+    // most recently used first
+    Entries _entries;
+    std::unordered_map<Key, typename Entries::iterator, Hash> _index;
+};
+
+template<typename Key, typename Value, typename Hash>
+LruCache<Key, Value, Hash>::LruCache(size_t maxSize, Clock::duration ttl) :
+    _maxSize(maxSize > 0 ? maxSize : 1), _ttl(ttl)
+{
+}
+
+template<typename Key, typename Value, typename Hash>
+const Value* LruCache<Key, Value, Hash>::find(const Key& key)
+{
+    auto it = _index.find(key);
+    if(_index.end() == it)
+        return nullptr;
+
+    typename Entries::iterator entryIt = it->second;
+    if(entryIt->expiresAt < Clock::now()) {
+        _entries.erase(entryIt);
+        _index.erase(it);
+        return nullptr;
+    }
+
+    _entries.splice(_entries.begin(), _entries, entryIt);
+
+    return &entryIt->value;
+}
+
+template<typename Key, typename Value, typename Hash>
+void LruCache<Key, Value, Hash>::put(const Key& key, const Value& value)
+{
+    const Clock::time_point expiresAt = Clock::now() + _ttl;
+
+    auto it = _index.find(key);
+    if(_index.end() != it) {
+        typename Entries::iterator entryIt = it->second;
+        entryIt->value = value;
+        entryIt->expiresAt = expiresAt;
+        _entries.splice(_entries.begin(), _entries, entryIt);
+        return;
+    }
+
+    if(_index.size() >= _maxSize) {
+        _index.erase(_entries.back().key);
+        _entries.pop_back();
+    }
+
+    _entries.push_front(Entry { key, value, expiresAt });
+    _index.emplace(key, _entries.begin());
+}
+
+template<typename Key, typename Value, typename Hash>
+void LruCache<Key, Value, Hash>::erase(const Key& key)
+{
+    auto it = _index.find(key);
+    if(_index.end() == it)
+        return;
+
+    _entries.erase(it->second);
+    _index.erase(it);
+}
+
+template<typename Key, typename Value, typename Hash>
+void LruCache<Key, Value, Hash>::clear()
+{
+    _index.clear();
+    _entries.clear();
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+
+
+// bounded lock free multiple producers single consumer queue
+// (D. Vyukov's bounded queue with consumer side simplified)
+template<typename T>
+class MpscQueue
+{
+public:
+    // capacity is rounded up to power of 2
+    inline explicit MpscQueue(size_t capacity);
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator = (const MpscQueue&) = delete;
+
+    // could be called from any thread,
+    // returns false if queue is full
+    inline bool push(T&&);
+
+    // should be called only from consumer thread,
+    // returns false if queue is empty
+    inline bool pop(T*);
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    enum {
+        CACHE_LINE_SIZE = 64,
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+
+    // producers and consumer positions live in different cache lines
+    char _pad0[CACHE_LINE_SIZE];
+    std::atomic<size_t> _enqueuePos;
+    char _pad1[CACHE_LINE_SIZE];
+    size_t _dequeuePos;
+};
+
+template<typename T>
+MpscQueue<T>::MpscQueue(size_t capacity) :
+    _enqueuePos(0), _dequeuePos(0)
+{
+    size_t size = 2;
+    while(size < capacity)
+        size <<= 1;
+
+    _cells.reset(new Cell[size]);
+    _mask = size - 1;
+
+    for(size_t i = 0; i < size; ++i)
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool MpscQueue<T>::push(T&& value)
+{
+    size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    for(;;) {
+        Cell& cell = _cells[pos & _mask];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        const ptrdiff_t diff =
+            static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(pos);
+        if(0 == diff) {
+            if(_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.value = std::move(value);
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if(diff < 0) {
+            return false; // full
+        } else
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+bool MpscQueue<T>::pop(T* value)
+{
+    Cell& cell = _cells[_dequeuePos & _mask];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if(static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(_dequeuePos + 1) < 0)
+        return false; // empty
+
+    *value = std::move(cell.value);
+    cell.sequence.store(_dequeuePos + _mask + 1, std::memory_order_release);
+    ++_dequeuePos;
+
+    return true;
+}
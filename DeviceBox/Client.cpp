@@ -70,6 +70,30 @@ ClientSecureContext::ClientSecureContext(const AuthConfig* authConfig) :
         ClientLog()->critical("Failed to load key: {}", error.message());
         return;
     }
+
+    SSL_CTX* ctx = native_handle();
+
+    if(!SSL_CTX_set_cipher_list(ctx, TLS_CIPHERS)) {
+        ClientLog()->critical("SSL_CTX_set_cipher_list failed");
+        return;
+    }
+
+    if(!SSL_CTX_set1_curves_list(ctx, TLS_CURVES)) {
+        ClientLog()->critical("SSL_CTX_set1_curves_list failed");
+        return;
+    }
+
+    // NetworkCore creates new SSL object on every connect,
+    // so session is stored here and attached to it at handshake start
+    SSL_CTX_set_app_data(ctx, this);
+    SSL_CTX_set_session_cache_mode(
+        ctx,
+        SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &ClientSecureContext::onNewSession);
+    SSL_CTX_set_info_callback(ctx, &ClientSecureContext::onInfo);
+#if !TLS_SESSION_TICKETS
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+#endif
 #else
     set_verify_mode(asio::ssl::verify_none, error);
     if(error) {
@@ -95,6 +119,41 @@ bool ClientSecureContext::valid() const
     return _valid;
 }
 
+void ClientSecureContext::forgetSession()
+{
+    _session.reset();
+}
+
+int ClientSecureContext::onNewSession(SSL* ssl, SSL_SESSION* session)
+{
+    ClientSecureContext* self =
+        static_cast<ClientSecureContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    if(!self)
+        return 0;
+
+    self->_session.reset(session);
+
+    return 1; // session ownership is taken
+}
+
+void ClientSecureContext::onInfo(const SSL* ssl, int where, int /*ret*/)
+{
+    if(!(where & SSL_CB_HANDSHAKE_START))
+        return;
+
+    // already has session (renegotiation or post handshake message)
+    if(SSL_get_session(ssl))
+        return;
+
+    ClientSecureContext* self =
+        static_cast<ClientSecureContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    if(!self || !self->_session)
+        return;
+
+    if(!SSL_set_session(const_cast<SSL*>(ssl), self->_session.get()))
+        ClientLog()->warn("SSL_set_session failed");
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 const std::shared_ptr<spdlog::logger>& Client::Log()
 {
@@ -108,7 +167,13 @@ Client::Client(
     NetworkCore::Client(ioService, static_cast<SecureContext*>(this)),
     _controller(controller),
     _port(0),
-    _reconnectTimer(*ioService)
+    _reconnectTimer(*ioService),
+    _reconnectBackoff(RECONNECT_MIN_TIMEOUT * 1000, RECONNECT_MAX_TIMEOUT * 1000),
+    _heartbeatTimer(*ioService),
+    _heartbeatTimeout(0),
+    _serverLost(false),
+    _batchMessages(false),
+    _flushScheduled(false)
 {
 }
 
@@ -118,6 +183,9 @@ void Client::onError(const asio::error_code& error)
 
     Log()->error(message);
 
+    _heartbeatTimeout = 0;
+    _heartbeatTimer.cancel();
+
     const std::function<void()> scheduleConnect =
         std::bind(&Client::scheduleConnect, this);
 
@@ -165,10 +233,12 @@ void Client::scheduleConnect()
         return;
     }
 
-    Log()->info("Scheduling reconnect within {} seconds", RECONNECT_TIMEOUT);
+    const std::chrono::milliseconds reconnectDelay = _reconnectBackoff.next();
+
+    Log()->info("Scheduling reconnect within {} ms", reconnectDelay.count());
 
     auto self = shared_from_this();
-    _reconnectTimer.expires_from_now(std::chrono::seconds(RECONNECT_TIMEOUT));
+    _reconnectTimer.expires_from_now(reconnectDelay);
     _reconnectTimer.async_wait(
         [self, this] (const asio::error_code& error) {
             if(error)
@@ -179,11 +249,47 @@ void Client::scheduleConnect()
     );
 }
 
+void Client::restartHeartbeatTimeout()
+{
+    if(!_heartbeatTimeout)
+        return;
+
+    auto self = shared_from_this();
+    _heartbeatTimer.expires_from_now(std::chrono::seconds(_heartbeatTimeout));
+    _heartbeatTimer.async_wait(
+        [self, this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            // error of read pending on lost connection
+            // should not trigger one more reconnect
+            _serverLost = true;
+
+            // to let pending read fail right now,
+            // and not in the middle of next session
+            asio::error_code closeError;
+            secureStream().lowest_layer().close(closeError);
+
+            onError(asio::error::timed_out);
+        }
+    );
+}
+
 void Client::onConnected(const asio::error_code& errorCode)
 {
     NetworkCore::Client::onConnected(errorCode);
 
+    _serverLost = false;
+
+    // statuses queued for previous connection are meaningless for new one,
+    // server restores streams after ClientReady anyway
+    _pendingStreamStatuses.Clear();
+
     if(errorCode) {
+        // server could forget session, so don't try to resume it again
+        if(errorCode.category() == asio::error::get_ssl_category())
+            forgetSession();
+
         onError(errorCode);
         return;
     }
@@ -197,11 +303,16 @@ void Client::onMessage(
     const std::string& body,
     const asio::error_code& errorCode)
 {
+    if(_serverLost)
+        return;
+
     if(errorCode) {
         onError(errorCode);
         return;
     }
 
+    restartHeartbeatTimeout();
+
     if(parseMessage(type, body))
         readMessageAsync();
 }
@@ -209,9 +320,8 @@ void Client::onMessage(
 template<typename MessageType>
 bool Client::parseMessage(const std::string& body)
 {
-    MessageType message;
-    if(message.ParseFromString(body))
-        return onMessage(message);
+    if(const MessageType* message = _messageParser.parse<MessageType>(body))
+        return onMessage(*message);
 
     assert(false);
 
@@ -231,6 +341,16 @@ bool Client::parseMessage(MessageType type, const std::string& body)
             return parseMessage<Protocol::RequestStream>(body);
         case Protocol::StopStreamMessage:
             return parseMessage<Protocol::StopStream>(body);
+        case Protocol::RequestStreamsMessage:
+            return parseMessage<Protocol::RequestStreams>(body);
+        case Protocol::StopStreamsMessage:
+            return parseMessage<Protocol::StopStreams>(body);
+        case Protocol::RequestSnapshotMessage:
+            return parseMessage<Protocol::RequestSnapshot>(body);
+        case Protocol::RejectedMessage:
+            return parseMessage<Protocol::Rejected>(body);
+        case Protocol::PingMessage:
+            return parseMessage<Protocol::Ping>(body);
         default:
             assert(false);
             return false; // unknown message
@@ -239,15 +359,23 @@ bool Client::parseMessage(MessageType type, const std::string& body)
 
 void Client::sendMessage(Protocol::MessageType messageType, const Message& message)
 {
-    std::string messageBody = message.SerializeAsString();
-    writeMessageAsync(messageType, &messageBody);
+    // writeMessageAsync swaps buffer content,
+    // so buffer given back is reused for next message
+    Protocol::SerializeMessage(message, &_writeBuffer);
+    writeMessageAsync(messageType, &_writeBuffer);
 }
 
 bool Client::onConnected()
 {
     Log()->info("Connected");
 
+    _batchMessages = false;
+
     Protocol::ClientGreeting message;
+    message.set_supportsrejected(true);
+    message.set_supportsbatches(true);
+    message.set_supportsheartbeats(true);
+    message.set_supportssnapshots(true);
 
     sendMessage(Protocol::ClientGreetingMessage, message);
 
@@ -258,6 +386,19 @@ bool Client::onMessage(const Protocol::ServerGreeting& message)
 {
     Log()->debug("Got ServerGreeting");
 
+    // server is busy, so next reconnect should not be too early
+    if(message.has_retryafter())
+        _reconnectBackoff.retryAfter(message.retryafter());
+
+    _batchMessages = message.supportsbatches();
+
+    // one more interval to let late Ping come
+    if(message.heartbeatinterval()) {
+        _heartbeatTimeout =
+            message.heartbeatinterval() * (message.heartbeatmaxmissed() + 1);
+        restartHeartbeatTimeout();
+    }
+
     Protocol::ClientConfigRequest request;
     sendMessage(Protocol::ClientConfigRequestMessage, request);
 
@@ -266,6 +407,8 @@ bool Client::onMessage(const Protocol::ServerGreeting& message)
 
 void Client::sendReady()
 {
+    _reconnectBackoff.reset();
+
     Protocol::ClientReady message;
     sendMessage(Protocol::ClientReadyMessage, message);
 }
@@ -308,11 +451,40 @@ void Client::sendStreamStatus(const std::string& sourceId, bool success)
 {
     Log()->trace(">> Client::sendStreamStatus. sourceId: {}, success: {}", sourceId, success);
 
-    Protocol::StreamStatus message;
-    message.set_sourceid(sourceId);
-    message.set_success(success);
+    if(!_batchMessages) {
+        Protocol::StreamStatus message;
+        message.set_sourceid(sourceId);
+        message.set_success(success);
+
+        sendMessage(Protocol::StreamStatusMessage, message);
+        return;
+    }
+
+    Protocol::StreamStatus& status = *_pendingStreamStatuses.add_statuses();
+    status.set_sourceid(sourceId);
+    status.set_success(success);
 
-    sendMessage(Protocol::StreamStatusMessage, message);
+    if(_flushScheduled)
+        return;
+
+    // statuses reported during current event loop iteration
+    // will be sent with single message
+    _flushScheduled = true;
+    ioService().post(
+        std::bind(
+            &Client::flushStreamStatuses,
+            std::static_pointer_cast<Client>(shared_from_this())));
+}
+
+void Client::flushStreamStatuses()
+{
+    _flushScheduled = false;
+
+    if(!_pendingStreamStatuses.statuses_size())
+        return;
+
+    sendMessage(Protocol::StreamStatusesMessage, _pendingStreamStatuses);
+    _pendingStreamStatuses.Clear();
 }
 
 bool Client::onMessage(const Protocol::RequestStream& message)
@@ -346,9 +518,100 @@ bool Client::onMessage(const Protocol::StopStream& message)
     return true;
 }
 
+bool Client::onMessage(const Protocol::RequestStreams& message)
+{
+    Log()->debug("Got RequestStreams");
+
+    for(const Protocol::RequestStream& requestStream: message.streams()) {
+        if(!onMessage(requestStream))
+            return false;
+    }
+
+    return true;
+}
+
+bool Client::onMessage(const Protocol::StopStreams& message)
+{
+    Log()->debug("Got StopStreams");
+
+    for(const Protocol::StopStream& stopStream: message.streams()) {
+        if(!onMessage(stopStream))
+            return false;
+    }
+
+    return true;
+}
+
+void Client::sendSnapshot(
+    const std::string& sourceId,
+    bool success,
+    const std::string& jpeg)
+{
+    Log()->trace(">> Client::sendSnapshot. sourceId: {}, success: {}", sourceId, success);
+
+    Protocol::Snapshot message;
+    message.set_sourceid(sourceId);
+    message.set_success(success);
+    if(success)
+        message.set_jpeg(jpeg);
+
+    sendMessage(Protocol::SnapshotMessage, message);
+}
+
+bool Client::onMessage(const Protocol::RequestSnapshot& message)
+{
+    Log()->debug("Got RequestSnapshot");
+
+    const SnapshotHandler::Captured captured =
+        std::bind(
+            &Client::sendSnapshot,
+            std::static_pointer_cast<Client>(shared_from_this()),
+            message.sourceid(),
+            std::placeholders::_1, std::placeholders::_2);
+    ioService().post(
+        std::bind(
+            &Controller::snapshotRequested, _controller, message,
+            captured));
+
+    return true;
+}
+
+bool Client::onMessage(const Protocol::Rejected& message)
+{
+    Log()->warn("Rejected by server. Retry after {} seconds", message.retryafter());
+
+    _heartbeatTimeout = 0;
+    _heartbeatTimer.cancel();
+
+    _reconnectBackoff.retryAfter(message.retryafter());
+
+    const std::function<void()> scheduleConnect =
+        std::bind(&Client::scheduleConnect, this);
+
+    ioService().post(
+        std::bind(&Controller::reset, _controller, scheduleConnect));
+
+    return false;
+}
+
+bool Client::onMessage(const Protocol::Ping& message)
+{
+    Log()->trace("Got Ping #{}", message.sequence());
+
+    Protocol::Pong reply;
+    reply.set_sequence(message.sequence());
+    reply.set_timestamp(message.timestamp());
+
+    sendMessage(Protocol::PongMessage, reply);
+
+    return true;
+}
+
 void Client::shutdown(const std::function<void ()>& finished)
 {
     _reconnectTimer.cancel();
+    _heartbeatTimeout = 0;
+    _heartbeatTimer.cancel();
     NetworkCore::Client::shutdown(finished);
 }
 
@@ -7,6 +7,7 @@
 #include "Log.h"
 #include "AuthConfig.h"
 #include "Controller.h"
+#include "ReconnectBackoff.h"
 
 
 namespace DeviceBox
@@ -22,9 +23,25 @@ protected:
     const AuthConfig* authConfig() const;
     bool valid() const;
 
+    // to make next handshake full
+    void forgetSession();
+
+private:
+    struct SessionFree
+    {
+        void operator() (SSL_SESSION* session)
+            { SSL_SESSION_free(session); }
+    };
+
+    static int onNewSession(SSL*, SSL_SESSION*);
+    static void onInfo(const SSL*, int where, int ret);
+
 private:
     bool _valid;
     const AuthConfig * const _authConfig;
+
+    // last session, to resume it on reconnect
+    std::unique_ptr<SSL_SESSION, SessionFree> _session;
 };
 
 
@@ -34,9 +51,11 @@ class Client : private ClientSecureContext, public NetworkCore::Client
 public:
     enum {
 #ifdef NDEBUG
-        RECONNECT_TIMEOUT = 60, // seconds
+        RECONNECT_MIN_TIMEOUT = 5, // seconds
+        RECONNECT_MAX_TIMEOUT = 5 * 60, // seconds
 #else
-        RECONNECT_TIMEOUT = 5, // seconds
+        RECONNECT_MIN_TIMEOUT = 1, // seconds
+        RECONNECT_MAX_TIMEOUT = 30, // seconds
 #endif
     };
 
@@ -63,6 +82,8 @@ private:
     void connect();
     void scheduleConnect();
 
+    void restartHeartbeatTimeout();
+
     bool parseMessage(MessageType type, const std::string& body);
     template<typename MessageType>
     bool parseMessage(const std::string& body);
@@ -73,8 +94,15 @@ private:
     bool onMessage(const Protocol::ClientConfigReply&);
     bool onMessage(const Protocol::ClientConfigUpdated&);
     void sendStreamStatus(const std::string& sourceId, bool success);
+    void flushStreamStatuses();
     bool onMessage(const Protocol::RequestStream&);
     bool onMessage(const Protocol::StopStream&);
+    bool onMessage(const Protocol::RequestStreams&);
+    bool onMessage(const Protocol::StopStreams&);
+    void sendSnapshot(const std::string& sourceId, bool success, const std::string& jpeg);
+    bool onMessage(const Protocol::RequestSnapshot&);
+    bool onMessage(const Protocol::Rejected&);
+    bool onMessage(const Protocol::Ping&);
 
 private:
     Controller *const _controller;
@@ -83,6 +111,19 @@ private:
     unsigned short _port;
 
     asio::steady_timer _reconnectTimer;
+    ReconnectBackoff _reconnectBackoff;
+
+    // server is considered lost if nothing came from it during this timeout
+    asio::steady_timer _heartbeatTimer;
+    unsigned _heartbeatTimeout; // seconds, 0 - disabled
+    bool _serverLost;
+
+    Protocol::MessageParser _messageParser;
+    std::string _writeBuffer;
+
+    bool _batchMessages;
+    bool _flushScheduled;
+    Protocol::StreamStatuses _pendingStreamStatuses;
 };
 
 }
@@ -1,5 +1,7 @@
 #include "Config.h"
 
+#include <algorithm>
+
 #include <glib.h>
 
 
@@ -17,6 +19,31 @@ void Config::clear()
     _dropboxToken.clear();
 }
 
+void Config::FillSourceConfig(const Protocol::VideoSource& config, SourceConfig* outConfig)
+{
+    outConfig->id = config.id();
+    outConfig->uri = config.uri();
+    outConfig->user = config.user();
+    outConfig->password = config.password();
+    outConfig->desiredFileSize = 1 * 1024 * 1024;
+
+    outConfig->dropboxArchivePath = "/" + config.id() + "/"; // FIXME! в целях безопасности возможно не стоит использовать id в путях
+    outConfig->dropboxMaxStorage = config.dropboxmaxstorage() * 1024 * 1024;
+}
+
+// archivePath is not compared since it's temporary dir created for every loaded source
+bool Config::SameSourceConfig(const SourceConfig& x, const SourceConfig& y)
+{
+    return
+        x.id == y.id &&
+        x.uri == y.uri &&
+        x.user == y.user &&
+        x.password == y.password &&
+        x.desiredFileSize == y.desiredFileSize &&
+        x.dropboxArchivePath == y.dropboxArchivePath &&
+        x.dropboxMaxStorage == y.dropboxMaxStorage;
+}
+
 bool Config::loadSourceConfig(const Protocol::VideoSource& config, SourceConfig* outConfig)
 {
     // FIXME! use better place for temp files
@@ -27,15 +54,8 @@ bool Config::loadSourceConfig(const Protocol::VideoSource& config, SourceConfig*
         return false;
     }
 
-    outConfig->id = config.id();
-    outConfig->uri = config.uri();
-    outConfig->user = config.user();
-    outConfig->password = config.password();
+    FillSourceConfig(config, outConfig);
     outConfig->archivePath = tmp;
-    outConfig->desiredFileSize = 1 * 1024 * 1024;
-
-    outConfig->dropboxArchivePath = "/" + config.id() + "/"; // FIXME! в целях безопасности возможно не стоит использовать id в путях
-    outConfig->dropboxMaxStorage = config.dropboxmaxstorage() * 1024 * 1024;
 
     g_free(tmp);
 
@@ -63,9 +83,52 @@ void Config::loadConfig(const Protocol::ClientConfig& config)
     }
 }
 
-void Config::updateConfig(const Protocol::ClientConfig& config)
+void Config::updateConfig(
+    const Protocol::ClientConfig& config,
+    std::vector<std::string>* stoppedSources,
+    std::vector<std::string>* startedSources)
 {
-    assert(false);
+    std::map<std::string, SourceConfig> sources;
+
+    for(const Protocol::VideoSource& source: config.sources()) {
+        if(sources.find(source.id()) != sources.end())
+            continue;
+
+        auto it = _sources.find(source.id());
+        if(it != _sources.end()) {
+            SourceConfig sourceConfig;
+            FillSourceConfig(source, &sourceConfig);
+            sourceConfig.archivePath = it->second.archivePath;
+
+            if(SameSourceConfig(sourceConfig, it->second)) {
+                sources.emplace(source.id(), it->second);
+                continue;
+            }
+
+            stoppedSources->push_back(source.id());
+        }
+
+        SourceConfig sourceConfig;
+        if(loadSourceConfig(source, &sourceConfig)) {
+            sources.emplace(source.id(), sourceConfig);
+            startedSources->push_back(source.id());
+        }
+    }
+
+    for(const auto& pair: _sources) {
+        if(sources.find(pair.first) == sources.end() &&
+           std::find(stoppedSources->begin(), stoppedSources->end(), pair.first) == stoppedSources->end())
+        {
+            stoppedSources->push_back(pair.first);
+        }
+    }
+
+    _sources.swap(sources);
+
+    if(config.has_dropbox())
+        loadDropboxConfig(config.dropbox());
+    else
+        _dropboxToken.clear();
 }
 
 void Config::enumSources(const std::function<bool (const SourceConfig&)>& cb)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <vector>
 #include <functional>
 
 #include "Protocol/protocol.h"
@@ -18,7 +19,12 @@ public:
     void clear();
 
     void loadConfig(const Protocol::ClientConfig&);
-    void updateConfig(const Protocol::ClientConfig&);
+    // stoppedSources - removed and changed sources, which handlers should be stopped,
+    // startedSources - added and changed sources, which handlers should be started
+    void updateConfig(
+        const Protocol::ClientConfig&,
+        std::vector<std::string>* stoppedSources,
+        std::vector<std::string>* startedSources);
 
     void enumSources(const std::function<bool (const SourceConfig&)>&);
     bool findSource(const std::string& id, const std::function<void (const SourceConfig&)>&);
@@ -26,6 +32,9 @@ public:
     std::string dropboxToken() const;
 
 private:
+    static void FillSourceConfig(const Protocol::VideoSource& config, SourceConfig* outConfig);
+    static bool SameSourceConfig(const SourceConfig&, const SourceConfig&);
+
     bool loadSourceConfig(const Protocol::VideoSource& config, SourceConfig* outConfig);
     void loadDropboxConfig(const Protocol::DropboxConfig& config);
 
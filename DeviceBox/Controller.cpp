@@ -14,6 +14,7 @@ Controller::SourceHandlers::SourceHandlers(
     const AuthConfig* authConfig) :
     splitter(ioService, config),
     streamer(ioService, config, authConfig),
+    snapshotter(ioService, config),
     dropboxFolder(ioService, dropbox)
 {
 }
@@ -85,7 +86,7 @@ void Controller::startHandleSource(const SourceConfig& config)
     }
 }
 
-void Controller::removeSource(const SourceId& source, const std::function<void ()>& finished)
+void Controller::removeSource(const SourceId& source)
 {
     Log()->debug("Removing source {}", source);
 
@@ -96,54 +97,97 @@ void Controller::removeSource(const SourceId& source, const std::function<void (
     if(_handlers.end() != it) {
         const SourceHandlers& handlers = it->second;
         assert(!handlers.streamer.active() &&
+               !handlers.snapshotter.active() &&
                !handlers.splitter.active() &&
                !handlers.dropboxFolder.active());
         _handlers.erase(it);
     }
+}
 
-    if(_handlers.empty())
+void Controller::stopHandleSource(
+    const SourceId& sourceId,
+    const std::function<void ()>& finished)
+{
+    auto it = _handlers.find(sourceId);
+    if(_handlers.end() == it) {
         _ioService->post(finished);
+        return;
+    }
+
+    SourceHandlers& handlers = it->second;
+
+    Log()->debug("Shutting down {}", sourceId);
+
+    auto snapshotterShuttedDown =
+        [this, sourceId, finished] () {
+            Log()->debug("Snapshotter shutted down for {}", sourceId);
+            removeSource(sourceId);
+            _ioService->post(finished);
+        };
+
+    SnapshotHandler& snapshotter = handlers.snapshotter;
+    auto streamerShuttedDown =
+        [&snapshotter, sourceId, snapshotterShuttedDown] () {
+            Log()->debug("Streamer shutted down for {}", sourceId);
+            Log()->debug("Shutting down snapshotter for {}", sourceId);
+            snapshotter.shutdown(snapshotterShuttedDown);
+        };
+
+    StreamingHandler& streamer = handlers.streamer;
+    auto dropboxFolderShuttedDown =
+        [&streamer, sourceId, streamerShuttedDown] () {
+            Log()->debug("Dropbox folder shutted down for {}", sourceId);
+            Log()->debug("Shutting down streamer for {}", sourceId);
+            streamer.shutdown(streamerShuttedDown);
+        };
+
+    DropboxFolder& dropboxFolder = handlers.dropboxFolder;
+    auto splitterShuttedDown =
+        [&dropboxFolder, sourceId, dropboxFolderShuttedDown] () {
+            Log()->debug("Splitter shutted down for {}", sourceId);
+            Log()->debug("Shutting down dropbox folder for {}", sourceId);
+            dropboxFolder.shutdown(dropboxFolderShuttedDown);
+        };
+
+    handlers.splitter.shutdown(splitterShuttedDown);
+}
+
+void Controller::stopHandleSources(
+    const std::vector<SourceId>& sources,
+    const std::function<void ()>& finished)
+{
+    if(sources.empty()) {
+        _ioService->post(finished);
+        return;
+    }
+
+    // finished is called after the last of sources is stopped
+    std::shared_ptr<size_t> stoppingCount = std::make_shared<size_t>(sources.size());
+    auto sourceStopped =
+        [stoppingCount, finished] () {
+            if(0 == --(*stoppingCount))
+                finished();
+        };
+
+    for(const SourceId& sourceId: sources)
+        stopHandleSource(sourceId, sourceStopped);
 }
 
 void Controller::stopHandleSources(const std::function<void ()>& finished)
 {
     Log()->trace(">> Controller::stopHandleSources");
 
-    if(!_handlers.empty()) {
-        for(auto& pair: _handlers) {
-            const SourceId& sourceId = pair.first;
-            SourceHandlers& handlers = pair.second;
-
-            Log()->debug("Shutting down {}", sourceId);
-
-            auto streamerShuttedDown =
-                [this, sourceId, finished] () {
-                    Log()->debug("Streamer shutted down for {}", sourceId);
-                    removeSource(sourceId, finished);
-                };
-
-            StreamingHandler& streamer = handlers.streamer;
-            auto dropboxFolderShuttedDown =
-                [&streamer, sourceId, streamerShuttedDown] () {
-                    Log()->debug("Dropbox folder shutted down for {}", sourceId);
-                    Log()->debug("Shutting down streamer for {}", sourceId);
-                    streamer.shutdown(streamerShuttedDown);
-                };
-
-            DropboxFolder& dropboxFolder = handlers.dropboxFolder;
-            auto splitterShuttedDown =
-                [&dropboxFolder, sourceId, dropboxFolderShuttedDown] () {
-                    Log()->debug("Splitter shutted down for {}", sourceId);
-                    Log()->debug("Shutting down dropbox folder for {}", sourceId);
-                    dropboxFolder.shutdown(dropboxFolderShuttedDown);
-                };
-
-            handlers.splitter.shutdown(splitterShuttedDown);
-        }
-    } else {
+    if(_handlers.empty()) {
         Log()->debug("No sources registered");
         _ioService->post(finished);
+        return;
     }
+
+    std::vector<SourceId> sources;
+    for(const auto& pair: _handlers)
+        sources.push_back(pair.first);
+
+    stopHandleSources(sources, finished);
 }
 
 void Controller::loadConfig(
@@ -177,7 +221,36 @@ void Controller::updateConfig(
 {
     Log()->trace(">> Controller::updateConfig");
 
-    loadConfig(config, finished);
+    if(_config.empty()) {
+        loadConfig(config, finished);
+        return;
+    }
+
+    // only sources which config was actually changed are restarted,
+    // others keep streaming and recording
+    std::vector<SourceId> stoppedSources;
+    std::vector<SourceId> startedSources;
+    _config.updateConfig(config, &stoppedSources, &startedSources);
+
+    _dropbox.setToken(_config.dropboxToken());
+
+    Log()->info(
+        "Config updated. Sources stopped: {}, started: {}",
+        stoppedSources.size(), startedSources.size());
+
+    auto startSources =
+        [this, startedSources, finished] () {
+            for(const SourceId& sourceId: startedSources) {
+                _config.findSource(sourceId,
+                    [this] (const SourceConfig& config) {
+                        startHandleSource(config);
+                    });
+            }
+
+            _ioService->post(finished);
+        };
+
+    stopHandleSources(stoppedSources, startSources);
 }
 
 void Controller::streamRequested(
@@ -214,6 +287,23 @@ void Controller::stopStream(const Protocol::StopStream& request)
     }
 }
 
+void Controller::snapshotRequested(
+    const Protocol::RequestSnapshot& request,
+    const SnapshotHandler::Captured& captured)
+{
+    Log()->trace(">> Controller::snapshotRequested");
+
+    auto it = _handlers.find(request.sourceid());
+    if(_handlers.end() == it) {
+        Log()->error("Snapshot requested for unknown source {}", request.sourceid());
+        _ioService->post(std::bind(captured, false, std::string()));
+        return;
+    }
+
+    SourceHandlers& handlers = it->second;
+    handlers.snapshotter.capture(captured);
+}
+
 void Controller::scheduleShrinkStorage()
 {
     _shrinkTimer.expires_from_now(std::chrono::seconds(SHRINK_INTERVAL));
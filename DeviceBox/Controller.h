@@ -13,6 +13,7 @@ class SourceConfig; // #include "SourceConfig.h"
 #include "AuthConfig.h"
 #include "StreamingHandler.h"
 #include "SplitHandler.h"
+#include "SnapshotHandler.h"
 #include "Dropbox.h"
 #include "DropboxFolder.h"
 
@@ -36,6 +37,8 @@ public:
                          const std::function<void ()>& streaming,
                          const std::function<void ()>& streamingFailed);
     void stopStream(const Protocol::StopStream&);
+    void snapshotRequested(const Protocol::RequestSnapshot&,
+                           const SnapshotHandler::Captured& captured);
 
     void reset(const std::function<void ()>& finished);
     void shutdown(const std::function<void ()>& finished);
@@ -48,6 +51,8 @@ private:
     static inline const std::shared_ptr<spdlog::logger>& Log();
 
     void startHandleSource(const SourceConfig& config);
+    void stopHandleSource(const SourceId&, const std::function<void ()>& finished);
+    void stopHandleSources(const std::vector<SourceId>&, const std::function<void ()>& finished);
     void stopHandleSources(const std::function<void ()>& finished);
 
     void startSplit(const SourceConfig& config);
@@ -56,7 +61,7 @@ private:
     void scheduleShrinkStorage();
     void shrinkStorage();
 
-    void removeSource(const SourceId& source, const std::function<void ()>& finished);
+    void removeSource(const SourceId& source);
 
 private:
     asio::io_service* _ioService;
@@ -78,6 +83,7 @@ private:
 
         SplitHandler splitter;
         StreamingHandler streamer;
+        SnapshotHandler snapshotter;
         DropboxFolder dropboxFolder;
     };
 
@@ -0,0 +1,43 @@
+#include "ReconnectBackoff.h"
+
+#include <algorithm>
+
+
+namespace DeviceBox
+{
+
+ReconnectBackoff::ReconnectBackoff(unsigned minDelay, unsigned maxDelay) :
+    _minDelay(minDelay), _maxDelay(std::max(minDelay, maxDelay)),
+    _random(std::random_device()()),
+    _delay(minDelay),
+    _retryAfter(0)
+{
+}
+
+void ReconnectBackoff::retryAfter(unsigned seconds)
+{
+    _retryAfter = seconds;
+}
+
+std::chrono::milliseconds ReconnectBackoff::next()
+{
+    std::uniform_int_distribution<unsigned> distribution(
+        _minDelay, std::max(_minDelay, _delay * 3));
+    _delay = std::min(_maxDelay, distribution(_random));
+
+    const unsigned delay = std::max(_delay, _retryAfter * 1000);
+    _retryAfter = 0;
+
+    return std::chrono::milliseconds(delay);
+}
+
+void ReconnectBackoff::reset()
+{
+    _delay = _minDelay;
+
+    // server's hint is about the connection it was given in,
+    // and that one is established successfully
+    _retryAfter = 0;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+
+
+namespace DeviceBox
+{
+
+// "decorrelated jitter" exponential backoff,
+// to not let devices disconnected at the same moment reconnect simultaneously
+class ReconnectBackoff
+{
+public:
+    ReconnectBackoff(unsigned minDelay, unsigned maxDelay); // milliseconds
+
+    // server is busy, so next delay should not be shorter
+    void retryAfter(unsigned seconds);
+
+    std::chrono::milliseconds next();
+    // should be called when connection is established successfully
+    void reset();
+
+private:
+    const unsigned _minDelay;
+    const unsigned _maxDelay;
+
+    std::mt19937 _random;
+    unsigned _delay; // milliseconds
+    unsigned _retryAfter; // seconds, requested by server
+};
+
+}
@@ -0,0 +1,325 @@
+#include "SnapshotHandler.h"
+
+#include <cassert>
+#include <atomic>
+#include <vector>
+
+#include <gst/gst.h>
+
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+
+
+namespace DeviceBox
+{
+
+struct SnapshotHandler::Private
+{
+    static inline const std::shared_ptr<spdlog::logger>& Log();
+
+    Private(SnapshotHandler*, asio::io_service*, const SourceConfig&);
+
+    bool startCapture();
+    void stopCapture();
+    void finishCapture(unsigned captureId, bool success, const std::string& jpeg);
+
+    static void DecodebinPadAdded(
+        GstElement*, GstPad*,
+        Private*);
+    static void Handoff(
+        GstElement*, GstBuffer*, GstPad*,
+        Private*);
+    static GstBusSyncReply threadedBusMessage(
+        GstBus*, GstMessage*, gpointer userData);
+
+public:
+    SnapshotHandler *const owner;
+    asio::io_service* ioService;
+
+    SourceConfig config;
+
+    asio::steady_timer timeoutTimer;
+
+    GstElementPtr pipeline;
+    GstElement* convert;
+
+    // identifies current capture,
+    // to ignore results of previous one arrived late,
+    // read from GStreamer streaming threads
+    std::atomic<unsigned> captureId;
+    std::atomic<bool> captured;
+
+    std::vector<Captured> waiters;
+};
+
+const std::shared_ptr<spdlog::logger>& SnapshotHandler::Private::Log()
+{
+    return DeviceBox::StreamingLog();
+}
+
+SnapshotHandler::Private::Private(
+    SnapshotHandler* owner,
+    asio::io_service* ioService,
+    const SourceConfig& config) :
+    owner(owner),
+    ioService(ioService),
+    config(config),
+    timeoutTimer(*ioService),
+    convert(nullptr),
+    captureId(0),
+    captured(false)
+{
+    static const bool gstreamerInitDone =
+        gst_init_check(0, nullptr, nullptr);
+    assert(gstreamerInitDone);
+}
+
+void SnapshotHandler::Private::DecodebinPadAdded(
+    GstElement* /*uridecodebin*/, GstPad* pad,
+    Private* self)
+{
+    GstElement* pipeline = self->pipeline.get();
+
+    GstCapsPtr capsPtr(gst_pad_query_caps(pad, nullptr));
+    GstCaps* caps = capsPtr.get();
+
+    GstPadPtr convertSinkPadPtr(gst_element_get_static_pad(self->convert, "sink"));
+    GstPad* convertSinkPad = convertSinkPadPtr.get();
+
+    const GstStructure* structure = gst_caps_get_structure(caps, 0);
+    if(structure &&
+       gst_structure_has_name(structure, "video/x-raw") &&
+       !gst_pad_is_linked(convertSinkPad))
+    {
+        if(GST_PAD_LINK_OK != gst_pad_link(pad, convertSinkPad))
+            assert(false);
+
+        return;
+    }
+
+    GstElement* fakesink = gst_element_factory_make("fakesink", nullptr);
+    gst_bin_add(GST_BIN(pipeline), fakesink);
+    gst_element_sync_state_with_parent(fakesink);
+
+    GstPadPtr sinkPadPtr(gst_element_get_static_pad(fakesink, "sink"));
+    if(GST_PAD_LINK_OK != gst_pad_link(pad, sinkPadPtr.get()))
+        assert(false);
+}
+
+void SnapshotHandler::Private::Handoff(
+    GstElement* /*fakesink*/, GstBuffer* buffer, GstPad* /*pad*/,
+    Private* self)
+{
+    // only the first encoded frame is needed
+    if(self->captured.exchange(true))
+        return;
+
+    GstMapInfo mapInfo;
+    if(!gst_buffer_map(buffer, &mapInfo, GST_MAP_READ)) {
+        Log()->error("Failed to map snapshot buffer");
+        return;
+    }
+
+    const std::string jpeg(reinterpret_cast<const char*>(mapInfo.data), mapInfo.size);
+    gst_buffer_unmap(buffer, &mapInfo);
+
+    const unsigned captureId = self->captureId;
+    RefCounter<SnapshotHandler> ownerRef(self->owner->_thisRefCounter);
+    self->ioService->post(
+        [ownerRef, captureId, jpeg] () {
+            ownerRef->_p->finishCapture(captureId, true, jpeg);
+        }
+    );
+}
+
+GstBusSyncReply SnapshotHandler::Private::threadedBusMessage(
+    GstBus* /*bus*/,
+    GstMessage* message,
+    gpointer userData)
+{
+    Private* self = static_cast<Private*>(userData);
+
+    switch(GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_EOS:
+        case GST_MESSAGE_ERROR: {
+            if(GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+                GError* error = nullptr;
+                gst_message_parse_error(message, &error, nullptr);
+                Log()->error("GStreamer. {}: {}", GST_ELEMENT_NAME(message->src), error->message);
+                g_error_free(error);
+            }
+
+            const unsigned captureId = self->captureId;
+            RefCounter<SnapshotHandler> ownerRef(self->owner->_thisRefCounter);
+            self->ioService->post(
+                [ownerRef, captureId] () {
+                    ownerRef->_p->finishCapture(captureId, false, std::string());
+                }
+            );
+            break;
+        }
+        default:
+            break;
+    }
+
+    return GST_BUS_PASS;
+}
+
+bool SnapshotHandler::Private::startCapture()
+{
+    this->pipeline.reset(gst_pipeline_new(nullptr));
+    GstElement* pipeline = this->pipeline.get();
+
+    GstElementPtr decodebinPtr(gst_element_factory_make("uridecodebin", nullptr));
+    GstElementPtr convertPtr(gst_element_factory_make("videoconvert", nullptr));
+    GstElementPtr scalePtr(gst_element_factory_make("videoscale", nullptr));
+    GstElementPtr capsfilterPtr(gst_element_factory_make("capsfilter", nullptr));
+    GstElementPtr jpegencPtr(gst_element_factory_make("jpegenc", nullptr));
+    GstElementPtr fakesinkPtr(gst_element_factory_make("fakesink", nullptr));
+
+    if(!decodebinPtr || !convertPtr || !scalePtr ||
+       !capsfilterPtr || !jpegencPtr || !fakesinkPtr)
+    {
+        Log()->critical("Fail to create snapshot pipeline elements");
+        this->pipeline.reset();
+        return false;
+    }
+
+    GstElement* decodebin = decodebinPtr.get();
+    GstElement* capsfilter = capsfilterPtr.get();
+    GstElement* fakesink = fakesinkPtr.get();
+
+    GstCapsPtr capsPtr(
+        gst_caps_new_simple(
+            "video/x-raw",
+            "width", G_TYPE_INT, static_cast<gint>(SNAPSHOT_WIDTH),
+            nullptr));
+    g_object_set(capsfilter, "caps", capsPtr.get(), nullptr);
+
+    g_object_set(fakesink,
+        "signal-handoffs", TRUE,
+        "sync", FALSE,
+        nullptr);
+    g_signal_connect(fakesink, "handoff", G_CALLBACK(Handoff), this);
+
+    g_object_set(decodebin, "uri", config.uri.c_str(), nullptr);
+    g_signal_connect(decodebin, "pad-added", G_CALLBACK(DecodebinPadAdded), this);
+
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_set_sync_handler(bus, threadedBusMessage, this, nullptr);
+    gst_object_unref(bus);
+
+    convert = convertPtr.get();
+
+    GstElement* scale = scalePtr.get();
+    GstElement* jpegenc = jpegencPtr.get();
+    gst_bin_add_many(
+        GST_BIN(pipeline),
+        decodebinPtr.release(), convertPtr.release(), scalePtr.release(),
+        capsfilterPtr.release(), jpegencPtr.release(), fakesinkPtr.release(),
+        nullptr);
+
+    if(!gst_element_link_many(convert, scale, capsfilter, jpegenc, fakesink, nullptr)) {
+        Log()->critical("Fail to link snapshot pipeline elements");
+        stopCapture();
+        return false;
+    }
+
+    ++captureId;
+    captured = false;
+
+    if(GST_STATE_CHANGE_FAILURE == gst_element_set_state(pipeline, GST_STATE_PLAYING)) {
+        Log()->error("Snapshot capture failed. Source: {}", config.uri);
+        stopCapture();
+        return false;
+    }
+
+    RefCounter<SnapshotHandler> ownerRef(owner->_thisRefCounter);
+    const unsigned captureId = this->captureId;
+    timeoutTimer.expires_from_now(std::chrono::seconds(CAPTURE_TIMEOUT));
+    timeoutTimer.async_wait(
+        [ownerRef, captureId] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            Log()->error("Snapshot capture timeout");
+
+            ownerRef->_p->finishCapture(captureId, false, std::string());
+        }
+    );
+
+    return true;
+}
+
+void SnapshotHandler::Private::stopCapture()
+{
+    timeoutTimer.cancel();
+
+    if(!pipeline)
+        return;
+
+    gst_element_set_state(pipeline.get(), GST_STATE_NULL);
+    pipeline.reset();
+    convert = nullptr;
+}
+
+void SnapshotHandler::Private::finishCapture(
+    unsigned captureId,
+    bool success,
+    const std::string& jpeg)
+{
+    if(captureId != this->captureId || !pipeline)
+        return;
+
+    stopCapture();
+
+    Log()->debug(
+        "Snapshot capture {}. Source: {}, size: {}",
+        success ? "succeeded" : "failed", config.id, jpeg.size());
+
+    std::vector<Captured> waiters;
+    waiters.swap(this->waiters);
+    for(const Captured& waiter: waiters)
+        ioService->post(std::bind(waiter, success, jpeg));
+}
+
+
+SnapshotHandler::SnapshotHandler(asio::io_service* ioService, const SourceConfig& config) :
+    _thisRefCounter(this), _p(new Private(this, ioService, config))
+{
+}
+
+SnapshotHandler::~SnapshotHandler()
+{
+    assert(!_p->pipeline);
+}
+
+bool SnapshotHandler::active() const
+{
+    return _thisRefCounter.hasRefs();
+}
+
+void SnapshotHandler::capture(const Captured& captured)
+{
+    _p->waiters.push_back(captured);
+
+    if(_p->pipeline)
+        return; // capture is in progress already
+
+    if(!_p->startCapture()) {
+        std::vector<Captured> waiters;
+        waiters.swap(_p->waiters);
+        for(const Captured& waiter: waiters)
+            _p->ioService->post(std::bind(waiter, false, std::string()));
+    }
+}
+
+void SnapshotHandler::shutdown(const std::function<void ()>& finished)
+{
+    _p->finishCapture(_p->captureId, false, std::string());
+
+    _p->ioService->post(finished);
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+#include <string>
+
+#include <asio.hpp>
+
+#include "Common/RefCounter.h"
+
+#include "SourceConfig.h"
+
+
+namespace DeviceBox
+{
+
+// captures single downscaled frame of source as JPEG,
+// requests arrived during capture get the same picture
+class SnapshotHandler
+{
+public:
+    enum {
+        SNAPSHOT_WIDTH = 320, // pixels
+        CAPTURE_TIMEOUT = 10, // seconds
+    };
+
+    typedef std::function<void (bool success, const std::string& jpeg)> Captured;
+
+    SnapshotHandler(asio::io_service*, const SourceConfig&);
+    ~SnapshotHandler();
+
+    bool active() const;
+
+    void capture(const Captured&);
+
+    void shutdown(const std::function<void ()>& finished);
+
+private:
+    RefCounter<SnapshotHandler> _thisRefCounter;
+
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
+
+}
@@ -9,6 +9,7 @@
 
 #include "finally_execute.h"
 #include "Log.h"
+#include "VideoCodecs.h"
 
 
 namespace DeviceBox
@@ -99,9 +100,11 @@ void SplitHandler::Private::DecodebinPadAdded(
     finally_execute unrefCaps =
         make_fin_exec(std::bind(gst_caps_unref, caps));
 
-    if(gst_caps_is_always_compatible(caps, supportedCaps)) {
-        GstElement* parse = gst_element_factory_make("h264parse", nullptr);
+    GstElement* parse = nullptr;
+    if(gst_caps_is_always_compatible(caps, supportedCaps))
+        parse = CreateVideoParser(caps);
 
+    if(parse) {
         gst_bin_add(GST_BIN(pipeline), parse);
         gst_element_sync_state_with_parent(parse);
 
@@ -171,7 +174,8 @@ void SplitHandler::Private::OnFilesinkStateChanged(
 
 void SplitHandler::Private::initPipeline()
 {
-    supportedCaps.reset(gst_caps_from_string("video/x-h264"));
+    // mpegtsmux accepts both H.264 and H.265
+    supportedCaps.reset(gst_caps_from_string(PassthroughVideoCaps));
     GstCaps* supportedCaps = this->supportedCaps.get();
 
     this->pipeline.reset(gst_pipeline_new(nullptr));
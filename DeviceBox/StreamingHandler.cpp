@@ -12,6 +12,7 @@
 #include "finally_execute.h"
 #include "Log.h"
 #include "CertificateProvider.h"
+#include "VideoCodecs.h"
 
 
 namespace DeviceBox
@@ -155,14 +156,11 @@ void Streamer::DecodebinPadAdded(
 
     bool skip = true;
     if(gst_caps_is_always_compatible(caps, supportedCaps)) {
-        GstElementPtr parsePtr(gst_element_factory_make("h264parse", nullptr));
+        // payloader matching codec is plugged by rtspclientsink itself
+        GstElementPtr parsePtr(CreateVideoParser(caps));
         GstElement* parse = parsePtr.get();
-        if(!parse)
-            Log()->critical("Fail to create \"h264parse\" element");
 
         if(parse) {
-            //g_object_set(parse, "config-interval", 1, nullptr);
-
             gst_bin_add(GST_BIN(pipeline), parsePtr.release());
             gst_element_sync_state_with_parent(parse);
 
@@ -253,7 +251,7 @@ void Streamer::initPipeline()
 {
     Log()->trace(">> Streamer::initPipeline");
 
-    _supportedCaps.reset(gst_caps_from_string("video/x-h264"));
+    _supportedCaps.reset(gst_caps_from_string(PassthroughVideoCaps));
 
     _pipeline.reset(gst_pipeline_new(nullptr));
     GstElement* pipeline = _pipeline.get();
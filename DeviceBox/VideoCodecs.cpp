@@ -0,0 +1,43 @@
+#include "VideoCodecs.h"
+
+#include "Log.h"
+
+
+namespace DeviceBox
+{
+
+const char* const PassthroughVideoCaps = "video/x-h264; video/x-h265";
+
+GstElement* CreateVideoParser(const GstCaps* caps)
+{
+    const GstStructure* structure = gst_caps_get_structure(caps, 0);
+    if(!structure)
+        return nullptr;
+
+    const char* parserName;
+    if(gst_structure_has_name(structure, "video/x-h264"))
+        parserName = "h264parse";
+    else if(gst_structure_has_name(structure, "video/x-h265"))
+        parserName = "h265parse";
+    else
+        return nullptr;
+
+    GstElement* parse = gst_element_factory_make(parserName, nullptr);
+    if(!parse) {
+        Log()->critical("Fail to create \"{}\" element", parserName);
+        return nullptr;
+    }
+
+    // SPS/PPS (and VPS for H.265) are sent with every IDR,
+    // so viewers joined to active stream can start decoding
+    // from the first key frame they get
+#if GST_CHECK_VERSION(1, 12, 0)
+    g_object_set(parse, "config-interval", -1, nullptr);
+#else
+    g_object_set(parse, "config-interval", 1, nullptr);
+#endif
+
+    return parse;
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <gst/gst.h>
+
+
+namespace DeviceBox
+{
+
+// video sent to restream server and stored to archive as is, without transcoding
+extern const char* const PassthroughVideoCaps;
+
+// creates parser suitable for passthrough video caps,
+// returns nullptr if codec is not supported
+GstElement* CreateVideoParser(const GstCaps*);
+
+}
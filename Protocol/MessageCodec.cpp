@@ -0,0 +1,36 @@
+#include "MessageCodec.h"
+
+
+namespace Protocol
+{
+
+bool SerializeMessage(const google::protobuf::MessageLite& message, std::string* buffer)
+{
+    const size_t size = message.ByteSizeLong();
+
+    buffer->resize(size);
+    if(!size)
+        return true;
+
+    message.SerializeWithCachedSizesToArray(
+        reinterpret_cast<google::protobuf::uint8*>(&(*buffer)[0]));
+
+    return true;
+}
+
+
+google::protobuf::ArenaOptions MessageParser::arenaOptions(char* initialBlock)
+{
+    google::protobuf::ArenaOptions options;
+    options.initial_block = initialBlock;
+    options.initial_block_size = INITIAL_BLOCK_SIZE;
+
+    return options;
+}
+
+MessageParser::MessageParser() :
+    _arena(arenaOptions(_initialBlock))
+{
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+
+#include <google/protobuf/message_lite.h>
+#include <google/protobuf/arena.h>
+
+
+namespace Protocol
+{
+
+// serializes message into buffer reusing it's capacity
+bool SerializeMessage(const google::protobuf::MessageLite&, std::string* buffer);
+
+// parses incoming messages into arena which memory is reused from message to message,
+// so parsed message is valid only until next parse() call
+class MessageParser
+{
+public:
+    enum {
+        INITIAL_BLOCK_SIZE = 4096,
+    };
+
+    MessageParser();
+
+    template<typename MessageType>
+    const MessageType* parse(const std::string& body);
+
+private:
+    static google::protobuf::ArenaOptions arenaOptions(char* initialBlock);
+
+private:
+    // arena requires initial block to be 8 bytes aligned
+    alignas(8) char _initialBlock[INITIAL_BLOCK_SIZE];
+    google::protobuf::Arena _arena;
+};
+
+template<typename MessageType>
+const MessageType* MessageParser::parse(const std::string& body)
+{
+    _arena.Reset();
+
+    MessageType* message =
+        google::protobuf::Arena::CreateMessage<MessageType>(&_arena);
+    if(!message->ParseFromArray(body.data(), static_cast<int>(body.size())))
+        return nullptr;
+
+    return message;
+}
+
+}
@@ -1,3 +1,4 @@
 #pragma once
 
 #include "protocol.pb.h"
+#include "MessageCodec.h"
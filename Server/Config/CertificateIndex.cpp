@@ -0,0 +1,182 @@
+#include "CertificateIndex.h"
+
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <CxxPtr/OpenSSLPtr.h>
+
+#include "Log.h"
+
+
+namespace Server
+{
+
+namespace Config
+{
+
+bool MakeFingerprint(X509* cert, CertificateFingerprint* fingerprint)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestSize = 0;
+    if(!X509_digest(cert, EVP_sha256(), digest, &digestSize)) {
+        ConfigLog()->error("X509_digest failed");
+        return false;
+    }
+
+    fingerprint->assign(reinterpret_cast<const char*>(digest), digestSize);
+
+    return true;
+}
+
+bool MakeFingerprint(GTlsCertificate* cert, CertificateFingerprint* fingerprint)
+{
+    GByteArray* derCertificate = nullptr;
+    g_object_get(cert, "certificate", &derCertificate, NULL);
+    if(!derCertificate) {
+        ConfigLog()->error("certificate access failed");
+        return false;
+    }
+
+    fingerprint->resize(SHA256_DIGEST_LENGTH);
+    SHA256(
+        derCertificate->data,
+        derCertificate->len,
+        reinterpret_cast<unsigned char*>(&(*fingerprint)[0]));
+
+    g_byte_array_unref(derCertificate);
+
+    return true;
+}
+
+
+bool CertificateIndex::empty() const
+{
+    return _devices.empty();
+}
+
+size_t CertificateIndex::size() const
+{
+    return _devices.size();
+}
+
+void CertificateIndex::clear()
+{
+    _devices.clear();
+}
+
+bool CertificateIndex::add(const std::string& pemCertificate, const DeviceId& deviceId)
+{
+    if(pemCertificate.empty()) {
+        ConfigLog()->warn("Empty device certificate. Device: {}", deviceId);
+        return false;
+    }
+
+    BIOPtr certBioPtr(BIO_new(BIO_s_mem()));
+    BIO* certBio = certBioPtr.get();
+    if(!certBio) {
+        ConfigLog()->error("BIO_new failed");
+        return false;
+    }
+
+    if(BIO_write(certBio, pemCertificate.data(), pemCertificate.size()) <= 0) {
+        ConfigLog()->error("BIO_write failed");
+        return false;
+    }
+
+    X509Ptr certPtr(PEM_read_bio_X509(certBio, NULL, NULL, NULL));
+    X509* cert = certPtr.get();
+    if(!cert) {
+        ConfigLog()->error("Failed parse device certificate. Device: {}", deviceId);
+        return false;
+    }
+
+    CertificateFingerprint fingerprint;
+    if(!MakeFingerprint(cert, &fingerprint))
+        return false;
+
+    const time_t now = time(nullptr);
+
+    int days = 0, seconds = 0;
+    if(!ASN1_TIME_diff(&days, &seconds, nullptr, X509_get_notBefore(cert))) {
+        ConfigLog()->error("Invalid device certificate start time. Device: {}", deviceId);
+        return false;
+    }
+
+    const time_t notBefore =
+        now + static_cast<time_t>(days) * 24 * 60 * 60 + seconds;
+
+    if(!ASN1_TIME_diff(&days, &seconds, nullptr, X509_get_notAfter(cert))) {
+        ConfigLog()->error("Invalid device certificate expiration time. Device: {}", deviceId);
+        return false;
+    }
+
+    const time_t notAfter =
+        now + static_cast<time_t>(days) * 24 * 60 * 60 + seconds;
+
+    auto it = _devices.find(fingerprint);
+    if(_devices.end() != it && it->second.deviceId != deviceId) {
+        ConfigLog()->error(
+            "Devices \"{}\" and \"{}\" have the same certificate. Device \"{}\" skipped.",
+            it->second.deviceId, deviceId, deviceId);
+        return false;
+    }
+
+    _devices[fingerprint] = Entry { deviceId, notBefore, notAfter };
+
+    return true;
+}
+
+bool CertificateIndex::find(const CertificateFingerprint& fingerprint, DeviceId* deviceId) const
+{
+    auto it = _devices.find(fingerprint);
+    if(_devices.end() == it) {
+        ConfigLog()->error("Client certificate is NOT allowed");
+        return false;
+    }
+
+    const time_t now = time(nullptr);
+
+    if(it->second.notBefore > now) {
+        ConfigLog()->error(
+            "Client certificate is not yet valid. Device: {}",
+            it->second.deviceId);
+        return false;
+    }
+
+    if(it->second.notAfter < now) {
+        ConfigLog()->error(
+            "Client certificate is expired. Device: {}",
+            it->second.deviceId);
+        return false;
+    }
+
+    ConfigLog()->info("Client certificate is allowed. Device: {}", it->second.deviceId);
+
+    if(deviceId)
+        *deviceId = it->second.deviceId;
+
+    return true;
+}
+
+bool CertificateIndex::find(X509* cert, DeviceId* deviceId) const
+{
+    CertificateFingerprint fingerprint;
+    if(!MakeFingerprint(cert, &fingerprint))
+        return false;
+
+    return find(fingerprint, deviceId);
+}
+
+bool CertificateIndex::find(GTlsCertificate* cert, DeviceId* deviceId) const
+{
+    CertificateFingerprint fingerprint;
+    if(!MakeFingerprint(cert, &fingerprint))
+        return false;
+
+    return find(fingerprint, deviceId);
+}
+
+}
+
+}
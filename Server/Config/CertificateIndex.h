@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <ctime>
+
+#include <openssl/x509.h>
+#include <gio/gio.h>
+
+#include <Common/CommonTypes.h>
+
+
+namespace Server
+{
+
+namespace Config
+{
+
+// SHA-256 of DER encoded certificate
+typedef std::string CertificateFingerprint;
+
+bool MakeFingerprint(X509*, CertificateFingerprint*);
+bool MakeFingerprint(GTlsCertificate*, CertificateFingerprint*);
+
+// maps device certificate fingerprint to device Id,
+// so authentication costs one digest and one hash lookup
+class CertificateIndex
+{
+public:
+    bool empty() const;
+    size_t size() const;
+    void clear();
+
+    bool add(const std::string& pemCertificate, const DeviceId&);
+
+    bool find(X509*, DeviceId*) const;
+    bool find(GTlsCertificate*, DeviceId*) const;
+
+private:
+    struct Entry
+    {
+        DeviceId deviceId;
+        time_t notBefore;
+        time_t notAfter;
+    };
+
+    bool find(const CertificateFingerprint&, DeviceId*) const;
+
+private:
+    std::unordered_map<CertificateFingerprint, Entry> _devices;
+};
+
+}
+
+}
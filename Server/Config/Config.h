@@ -26,6 +26,9 @@ struct Source
     std::string uri;
 
     unsigned dropboxMaxStorage; // in megabytes
+
+    // how long device keeps streaming after last viewer left, in seconds
+    unsigned linger;
 };
 
 struct Device
@@ -61,6 +64,7 @@ struct Server
     Port controlServerPort;
     Port staticServerPort;
     Port restreamServerPort;
+    Port snapshotServerPort;
 
     URL noSignalSplashSource;
 };
@@ -70,10 +74,18 @@ struct Config
     virtual ~Config() {}
 
     // to use in some new thread
-    virtual std::unique_ptr<const Config> clone() const = 0;
+    virtual std::unique_ptr<Config> clone() const = 0;
 
     virtual const Server* serverConfig() const = 0;
 
+    // changes every time config content is changed,
+    // to let users invalidate data derived from config
+    virtual unsigned generation() const { return 0; }
+
+    // reloads data cached from backend if backend content was changed,
+    // returns true if generation() was changed
+    virtual bool checkForUpdates() { return false; }
+
     // should include private key and intermediate certs
     virtual std::string certificate() const = 0;
 
@@ -0,0 +1,113 @@
+#include "CredentialsCache.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "Log.h"
+
+
+namespace Server
+{
+
+namespace Config
+{
+
+CredentialsCache::CredentialsCache() :
+    _hasHmacKey(false),
+    _generation(0),
+    _credentials(CACHE_SIZE, std::chrono::seconds(ENTRY_TTL))
+{
+    _hasHmacKey = RAND_bytes(_hmacKey, sizeof(_hmacKey)) == 1;
+    if(!_hasHmacKey)
+        ConfigLog()->error("RAND_bytes failed, credentials cache is disabled");
+}
+
+CredentialsCache::~CredentialsCache()
+{
+    OPENSSL_cleanse(_hmacKey, sizeof(_hmacKey));
+}
+
+bool CredentialsCache::key(
+    const UserName& userName,
+    const std::string& password,
+    std::string* out) const
+{
+    if(!_hasHmacKey)
+        return false;
+
+    std::string credentials;
+    credentials.reserve(userName.size() + 1 + password.size());
+    credentials += userName;
+    credentials += '\0';
+    credentials += password;
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestSize = 0;
+    const bool success =
+        nullptr != HMAC(
+            EVP_sha256(),
+            _hmacKey, sizeof(_hmacKey),
+            reinterpret_cast<const unsigned char*>(credentials.data()),
+            credentials.size(),
+            digest, &digestSize);
+
+    OPENSSL_cleanse(&credentials[0], credentials.size());
+
+    if(!success) {
+        ConfigLog()->error("HMAC failed");
+        return false;
+    }
+
+    out->assign(reinterpret_cast<const char*>(digest), digestSize);
+
+    return true;
+}
+
+unsigned CredentialsCache::generation() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _generation;
+}
+
+void CredentialsCache::invalidate()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    ++_generation;
+    _credentials.clear();
+}
+
+bool CredentialsCache::find(const UserName& userName, const std::string& password)
+{
+    std::string key;
+    if(!this->key(userName, password, &key))
+        return false;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _credentials.find(key) != nullptr;
+}
+
+void CredentialsCache::put(
+    unsigned generation,
+    const UserName& userName,
+    const std::string& password)
+{
+    std::string key;
+    if(!this->key(userName, password, &key))
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(generation != _generation)
+        return;
+
+    _credentials.put(key, true);
+}
+
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+
+#include <Common/CommonTypes.h>
+#include <Common/LruCache.h>
+
+
+namespace Server
+{
+
+namespace Config
+{
+
+// remembers credentials which passed password hash check,
+// so repeated authentication of the same user costs one hash table lookup,
+// entries are keyed by HMAC-SHA256 with random per process key
+// so plaintext passwords are not kept in memory,
+// thread safe
+class CredentialsCache
+{
+public:
+    enum {
+        CACHE_SIZE = 1024,
+        ENTRY_TTL = 60, // seconds
+        KEY_SIZE = 32, // bytes
+    };
+
+    CredentialsCache();
+    ~CredentialsCache();
+
+    // should be taken before credentials are checked with config
+    unsigned generation() const;
+    // drops all entries, should be called on config change
+    void invalidate();
+
+    bool find(const UserName&, const std::string& password);
+    // credentials checked before last invalidate() are not cached
+    void put(unsigned generation, const UserName&, const std::string& password);
+
+private:
+    // returns false if cache is unusable
+    bool key(const UserName&, const std::string& password, std::string* out) const;
+
+private:
+    unsigned char _hmacKey[KEY_SIZE];
+    bool _hasHmacKey;
+
+    mutable std::mutex _mutex;
+
+    unsigned _generation;
+    // digest of user name and password -> nothing
+    LruCache<std::string, bool> _credentials;
+};
+
+}
+
+}
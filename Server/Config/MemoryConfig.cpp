@@ -1,12 +1,8 @@
 #include "MemoryConfig.h"
 
-#include <openssl/pem.h>
-
 #undef CHAR_WIDTH
 #include <spdlog/fmt/fmt.h>
 
-#include <CxxPtr/GlibPtr.h>
-
 #include "Log.h"
 #include "Common/Keys.h"
 
@@ -19,7 +15,7 @@ namespace MemoryConfig
 
 Source* Device::addSource(const SourceId& sourceId)
 {
-    return &sources.emplace(sourceId, Source{.id = sourceId}).first->second;
+    return &sources.emplace(sourceId, Source{.id = sourceId, .linger = DEFAULT_STREAM_LINGER}).first->second;
 }
 
 const Source* Device::findSource(const SourceId& sourceId) const
@@ -68,6 +64,7 @@ Config::Config()
     _serverConfig.controlServerPort = DEFAULT_CONTROL_SERVER_PORT;
     _serverConfig.staticServerPort = DEFAULT_STATIC_SERVER_PORT;
     _serverConfig.restreamServerPort = DEFAULT_RESTREAM_SERVER_PORT;
+    _serverConfig.snapshotServerPort = DEFAULT_SNAPSHOT_SERVER_PORT;
 
 
     Device* deviceConfig = addDevice("device1");
@@ -103,143 +100,28 @@ std::string Config::certificate() const
 
 void Config::loadCertificates()
 {
-    _allowedClients.reset(X509_STORE_new());
-    X509_STORE* allowedClients = _allowedClients.get();
-    if(!allowedClients) {
-        ConfigLog()->error("X509_STORE_new failed");
-        return;
-    }
+    _certificateIndex.clear();
 
     enumDevices(
         [this] (const ::Server::Config::Device& device) {
-            if(device.certificate.empty()) {
-                ConfigLog()->warn("Empty device certificate");
-                return;
-            }
-
-            BIOPtr deviceCertBioPtr(BIO_new(BIO_s_mem()));
-            BIO* deviceCertBio = deviceCertBioPtr.get();
-            if(!deviceCertBio) {
-                ConfigLog()->error("BIO_new failed");
-                return;
-            }
-
-            if(BIO_write(
-                deviceCertBio,
-                device.certificate.data(),
-                device.certificate.size()) <= 0)
-            {
-                ConfigLog()->error("BIO_write failed");
-                return;
-            }
-
-            X509Ptr deviceCertPtr(PEM_read_bio_X509(deviceCertBio, NULL, NULL, NULL));
-            X509* deviceCert = deviceCertPtr.get();
-            if(!deviceCert) {
-                ConfigLog()->error("Failed parse device box certificate");
-                return;
-            }
-
-            if(!X509_STORE_add_cert(_allowedClients.get(), deviceCert)) {
-                ConfigLog()->error("X509_STORE_add_cert failed");
-            }
+            _certificateIndex.add(device.certificate, device.id);
         }
     );
+
+    ConfigLog()->info("Loaded {} device certificates", _certificateIndex.size());
 }
 
-bool Config::authenticate(X509* cert, std::string* name) const
+bool Config::authenticate(X509* cert, UserName* name) const
 {
-    X509_STORE* allowedClients = _allowedClients.get();
-    if(!allowedClients)
-        return false;
-
-    X509_STORE_CTXPtr ctxPtr(X509_STORE_CTX_new());
-    X509_STORE_CTX* ctx = ctxPtr.get();
-    if(!ctx) {
-        ConfigLog()->error("X509_STORE_CTX_new failed");
-        return false;
-    }
-
-    if(!X509_STORE_CTX_init(ctx, allowedClients, cert, NULL))
-        return false;
-
-    if(!X509_verify_cert(ctx)) {
-        ConfigLog()->error("Client certificate is NOT allowed");
-        return false;
-    }
-
-    X509_NAME* subject = X509_get_subject_name(cert);
-    if(!subject) {
-        ConfigLog()->error("X509_get_subject_name failed");
-        return false;
-    }
-
-    const int nameIndex = X509_NAME_get_index_by_NID(subject, NID_commonName, -1);
-    if(nameIndex < 0) {
-        ConfigLog()->error("X509_NAME_get_entry failed");
-        return false;
-    }
-
-    X509_NAME_ENTRY* nameEntry = X509_NAME_get_entry(subject, nameIndex);
-    if(!nameEntry) {
-        ConfigLog()->error("X509_NAME_get_entry failed");
-        return false;
-    }
-
-    ASN1_STRING* asn1Name = X509_NAME_ENTRY_get_data(nameEntry);
-    if(!asn1Name) {
-        ConfigLog()->error("X509_NAME_ENTRY_get_data failed");
-        return false;
-    }
-
-    const unsigned char* commonName = ASN1_STRING_data(asn1Name);
-    if(!commonName) {
-        ConfigLog()->error("ASN1_STRING_get0_data failed");
-        return false;
-    }
-
-    ConfigLog()->info("Client certificate is allowed. Subject: {}", commonName);
-
-    if(name)
-        *name = reinterpret_cast<const std::string::value_type*>(commonName);
-
-    return true;
+    return _certificateIndex.find(cert, name);
 }
 
 bool Config::authenticate(GTlsCertificate* cert, UserName* name) const
 {
-    BIOPtr certBioPtr(BIO_new(BIO_s_mem()));
-    BIO* certBio = certBioPtr.get();
-    if(!certBio) {
-        ConfigLog()->error("BIO_new failed");
-        return false;
-    }
-
-    gchar* pemCertificate;
-    g_object_get(cert, "certificate-pem", &pemCertificate, NULL);
-    if(!pemCertificate) {
-        ConfigLog()->error("certificate-pem access failed");
-        return false;
-    }
-
-    GCharPtr pemCertificatePtr(pemCertificate);
-
-    if(BIO_puts(certBio, pemCertificate) <= 0) {
-        ConfigLog()->error("BIO_write failed");
-        return false;
-    }
-
-    X509Ptr x509CertPtr(PEM_read_bio_X509(certBio, NULL, NULL, NULL));
-    X509* x509Cert = x509CertPtr.get();
-    if(!x509Cert) {
-        ConfigLog()->error("Failed parse client certificate");
-        return false;
-    }
-
-    return authenticate(x509Cert, name);
+    return _certificateIndex.find(cert, name);
 }
 
-std::unique_ptr<const ::Server::Config::Config> Config::clone() const
+std::unique_ptr<::Server::Config::Config> Config::clone() const
 {
     return std::make_unique<Config>();
 }
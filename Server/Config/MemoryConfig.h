@@ -1,8 +1,7 @@
 #pragma once
 
-#include <CxxPtr/OpenSSLPtr.h>
-
 #include "Config.h"
+#include "CertificateIndex.h"
 
 
 namespace Server
@@ -62,7 +61,7 @@ public:
     const ::Server::Config::Server* serverConfig() const override;
 
 
-    std::unique_ptr<const ::Server::Config::Config> clone() const override;
+    std::unique_ptr<::Server::Config::Config> clone() const override;
 
 
     std::string certificate() const override;
@@ -96,7 +95,7 @@ private:
     std::unordered_map<DeviceId, Device> _devices;
     std::unordered_map<UserName, User> _users;
 
-    X509_STOREPtr _allowedClients;
+    ::Server::Config::CertificateIndex _certificateIndex;
 };
 
 }
@@ -0,0 +1,190 @@
+#include "AdmissionGate.h"
+
+#include <algorithm>
+
+
+namespace ControlServer
+{
+
+const std::shared_ptr<spdlog::logger>& AdmissionGate::Log()
+{
+    return ControlServer::Log();
+}
+
+AdmissionGate::AdmissionGate(
+    asio::io_service* ioService,
+    const AdmitCallback& admit) :
+    _ioService(ioService), _admit(admit),
+    _pumpTimer(*ioService), _pumpScheduled(false),
+    _statsTimer(*ioService),
+    _tokens(HANDSHAKES_BURST), _lastRefill(Clock::now()),
+    _activeHandshakes(0),
+    _rejectingHandshakes(0),
+    _stats()
+{
+    scheduleStats();
+}
+
+unsigned AdmissionGate::retryAfterHint() const
+{
+    return _pending.size() / HANDSHAKES_RATE;
+}
+
+void AdmissionGate::drop(const std::shared_ptr<asio::ip::tcp::socket>& socket)
+{
+    asio::error_code error;
+
+    // reset connection to not keep it in TIME_WAIT
+    socket->set_option(asio::socket_base::linger(true, 0), error);
+    socket->close(error);
+}
+
+void AdmissionGate::enqueue(const std::shared_ptr<asio::ip::tcp::socket>& socket)
+{
+    if(_pending.size() >= MAX_PENDING_CONNECTIONS) {
+        if(_rejectingHandshakes < MAX_REJECTING_HANDSHAKES) {
+            ++_stats.rejected;
+            _admit(socket, makeTicket(true), true);
+        } else {
+            ++_stats.shed;
+            drop(socket);
+        }
+        return;
+    }
+
+    ++_stats.queued;
+
+    _pending.push_back(
+        Pending {
+            socket,
+            Clock::now() + std::chrono::seconds(PENDING_TIMEOUT)
+        });
+
+    pump();
+}
+
+void AdmissionGate::refill(Clock::time_point now)
+{
+    const std::chrono::duration<double> elapsed = now - _lastRefill;
+    _tokens =
+        std::min<double>(
+            HANDSHAKES_BURST,
+            _tokens + elapsed.count() * HANDSHAKES_RATE);
+    _lastRefill = now;
+}
+
+void AdmissionGate::pump()
+{
+    const Clock::time_point now = Clock::now();
+
+    refill(now);
+
+    while(!_pending.empty()) {
+        if(_pending.front().deadline < now) {
+            ++_stats.expired;
+            drop(_pending.front().socket);
+            _pending.pop_front();
+            continue;
+        }
+
+        if(_tokens < 1 || _activeHandshakes >= MAX_CONCURRENT_HANDSHAKES)
+            break;
+
+        _tokens -= 1;
+
+        std::shared_ptr<asio::ip::tcp::socket> socket = _pending.front().socket;
+        _pending.pop_front();
+
+        ++_stats.accepted;
+
+        _admit(socket, makeTicket(false), false);
+    }
+
+    if(!_pending.empty())
+        schedulePump(now);
+}
+
+void AdmissionGate::schedulePump(Clock::time_point now)
+{
+    if(_pumpScheduled)
+        return;
+
+    // wake up on next token or to expire oldest pending connection
+    Clock::duration delay = _pending.front().deadline - now;
+    if(_tokens < 1) {
+        const std::chrono::duration<double> tokenDelay((1 - _tokens) / HANDSHAKES_RATE);
+        delay = std::min(delay, std::chrono::duration_cast<Clock::duration>(tokenDelay));
+    }
+
+    _pumpScheduled = true;
+    _pumpTimer.expires_from_now(delay);
+    _pumpTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            _pumpScheduled = false;
+
+            pump();
+        }
+    );
+}
+
+AdmissionGate::Ticket AdmissionGate::makeTicket(bool rejecting)
+{
+    if(rejecting)
+        ++_rejectingHandshakes;
+    else
+        ++_activeHandshakes;
+
+    // ticket could be released on any thread
+    asio::io_service* ioService = _ioService;
+    std::weak_ptr<AdmissionGate> gateRef = shared_from_this();
+    return
+        Ticket(nullptr,
+            [ioService, gateRef, rejecting] (void*) {
+                ioService->post(
+                    [gateRef, rejecting] () {
+                        if(std::shared_ptr<AdmissionGate> gate = gateRef.lock())
+                            gate->handshakeFinished(rejecting);
+                    }
+                );
+            }
+        );
+}
+
+void AdmissionGate::handshakeFinished(bool rejecting)
+{
+    if(rejecting) {
+        assert(_rejectingHandshakes > 0);
+        --_rejectingHandshakes;
+        return;
+    }
+
+    assert(_activeHandshakes > 0);
+    --_activeHandshakes;
+
+    if(!_pending.empty())
+        pump();
+}
+
+void AdmissionGate::scheduleStats()
+{
+    _statsTimer.expires_from_now(std::chrono::seconds(STATS_INTERVAL));
+    _statsTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            Log()->info(
+                "Admission stats. queued: {}, accepted: {}, rejected: {}, shed: {}, expired: {}, "
+                "pending: {}, handshaking: {}, rejecting: {}",
+                _stats.queued, _stats.accepted, _stats.rejected, _stats.shed, _stats.expired,
+                _pending.size(), _activeHandshakes, _rejectingHandshakes);
+
+            scheduleStats();
+        }
+    );
+}
+
+}
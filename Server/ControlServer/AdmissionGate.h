@@ -0,0 +1,99 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <functional>
+#include <chrono>
+
+#include <asio.hpp>
+
+#include "Log.h"
+
+
+namespace ControlServer
+{
+
+// limits rate and concurrency of TLS handshakes,
+// so reconnect storm doesn't saturate CPU,
+// connections over pending queue capacity are handshaked only to be rejected
+// with reconnect hint, while there are few of them, and are reset otherwise
+class AdmissionGate : public std::enable_shared_from_this<AdmissionGate>
+{
+public:
+    enum {
+        HANDSHAKES_RATE = 200, // per second
+        HANDSHAKES_BURST = 400,
+        MAX_CONCURRENT_HANDSHAKES = 512,
+        MAX_PENDING_CONNECTIONS = 4096,
+        MAX_REJECTING_HANDSHAKES = 32,
+        PENDING_TIMEOUT = 5, // seconds
+        STATS_INTERVAL = 60, // seconds
+    };
+
+    // released when handshake is finished (successfully or not)
+    typedef std::shared_ptr<void> Ticket;
+
+    // overloaded - connection is admitted only to be rejected
+    typedef
+        std::function<void (
+            const std::shared_ptr<asio::ip::tcp::socket>&,
+            const Ticket&,
+            bool overloaded)> AdmitCallback;
+
+    AdmissionGate(asio::io_service*, const AdmitCallback&);
+
+    // should be called from gate's io_service thread
+    void enqueue(const std::shared_ptr<asio::ip::tcp::socket>&);
+
+    // seconds required to drain pending queue
+    unsigned retryAfterHint() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pending
+    {
+        std::shared_ptr<asio::ip::tcp::socket> socket;
+        Clock::time_point deadline;
+    };
+
+    static inline const std::shared_ptr<spdlog::logger>& Log();
+
+    static void drop(const std::shared_ptr<asio::ip::tcp::socket>&);
+
+    void refill(Clock::time_point now);
+    void pump();
+    void schedulePump(Clock::time_point now);
+    Ticket makeTicket(bool rejecting);
+    void handshakeFinished(bool rejecting);
+
+    void scheduleStats();
+
+private:
+    asio::io_service* _ioService;
+    AdmitCallback _admit;
+
+    asio::steady_timer _pumpTimer;
+    bool _pumpScheduled;
+    asio::steady_timer _statsTimer;
+
+    double _tokens;
+    Clock::time_point _lastRefill;
+
+    unsigned _activeHandshakes;
+    unsigned _rejectingHandshakes;
+    std::deque<Pending> _pending;
+
+    struct Stats
+    {
+        unsigned long long queued;
+        unsigned long long accepted;
+        unsigned long long rejected;
+        unsigned long long shed;
+        unsigned long long expired;
+    };
+
+    Stats _stats;
+};
+
+}
@@ -0,0 +1,99 @@
+#include "ClientConfigCache.h"
+
+#include "Protocol/protocol.h"
+
+#include "Log.h"
+
+
+namespace ControlServer
+{
+
+ClientConfigCache::ClientConfigCache(const ::Server::Config::Config* config) :
+    _config(config)
+{
+}
+
+const std::string* ClientConfigCache::reply(const DeviceId& deviceId)
+{
+    const unsigned configGeneration = _config->generation();
+
+    // entries built from previous config generation are kept
+    // to let changedReply compare with them
+    auto it = _replies.find(deviceId);
+    if(_replies.end() != it && it->second.configGeneration == configGeneration)
+        return &it->second.reply;
+
+    std::string reply;
+    if(!buildReply(deviceId, &reply)) {
+        if(_replies.end() != it)
+            _replies.erase(it);
+        return nullptr;
+    }
+
+    Entry& entry = _replies[deviceId];
+    entry.reply.swap(reply);
+    entry.configGeneration = configGeneration;
+
+    return &entry.reply;
+}
+
+const std::string* ClientConfigCache::changedReply(const DeviceId& deviceId)
+{
+    auto it = _replies.find(deviceId);
+    if(_replies.end() == it)
+        return nullptr;
+
+    std::string reply;
+    if(!buildReply(deviceId, &reply)) {
+        _replies.erase(it);
+        return nullptr;
+    }
+
+    Entry& entry = it->second;
+    entry.configGeneration = _config->generation();
+
+    if(entry.reply == reply)
+        return nullptr;
+
+    entry.reply.swap(reply);
+
+    return &entry.reply;
+}
+
+void ClientConfigCache::invalidate(const DeviceId& deviceId)
+{
+    _replies.erase(deviceId);
+}
+
+void ClientConfigCache::clear()
+{
+    _replies.clear();
+}
+
+bool ClientConfigCache::buildReply(const DeviceId& deviceId, std::string* out) const
+{
+    ::Server::Config::Device device;
+    if(!_config->findDevice(deviceId, &device))
+        return false;
+
+    Protocol::ClientConfigReply reply;
+
+    Protocol::ClientConfig& config = *(reply.mutable_config());
+
+    Protocol::DropboxConfig& dropbox = *config.mutable_dropbox();
+    dropbox.set_token(device.dropboxToken);
+
+    _config->enumDeviceSources(deviceId,
+        [&config] (const ::Server::Config::Source& sourceConfig) -> bool {
+            Protocol::VideoSource& source = *(config.add_sources());
+            source.set_id(sourceConfig.id);
+            source.set_uri(sourceConfig.uri);
+            source.set_dropboxmaxstorage(sourceConfig.dropboxMaxStorage);
+            return true;
+        }
+    );
+
+    return reply.SerializeToString(out);
+}
+
+}
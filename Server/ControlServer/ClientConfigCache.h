@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+#include <Common/CommonTypes.h>
+
+#include "Config/Config.h"
+
+
+namespace ControlServer
+{
+
+// keeps serialized Protocol::ClientConfigReply per device,
+// to not query config backend on every device (re)connect,
+// entry is valid until config generation is changed
+class ClientConfigCache
+{
+public:
+    ClientConfigCache(const ::Server::Config::Config*);
+
+    // returns nullptr if device is unknown
+    const std::string* reply(const DeviceId&);
+
+    // rebuilds device's reply and returns it only if it differs from cached one,
+    // returns nullptr if reply was never requested by device
+    const std::string* changedReply(const DeviceId&);
+
+    void invalidate(const DeviceId&);
+    void clear();
+
+private:
+    bool buildReply(const DeviceId&, std::string* out) const;
+
+private:
+    struct Entry
+    {
+        std::string reply;
+        unsigned configGeneration;
+    };
+
+    const ::Server::Config::Config *const _config;
+
+    std::unordered_map<DeviceId, Entry> _replies;
+};
+
+}
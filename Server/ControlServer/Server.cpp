@@ -1,8 +1,24 @@
 #include "Server.h"
 
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
 #include <Common/Keys.h>
+#include <Common/LruCache.h>
 
 #include "ServerSession.h"
+#include "Shard.h"
 
 #include "Protocol/protocol.h"
 
@@ -10,6 +26,255 @@
 namespace ControlServer
 {
 
+namespace {
+
+// shared by all shards contexts,
+// so ticket issued by one shard could be used to resume session on any other,
+// previous key is kept after rotation to accept tickets issued just before it
+class TicketKeys
+{
+public:
+    struct Key
+    {
+        unsigned char name[16];
+        unsigned char aesKey[32];
+        unsigned char hmacKey[32];
+    };
+
+    TicketKeys() : _hasCurrent(false), _hasPrevious(false)
+        { rotate(); }
+
+    bool rotate();
+
+    bool current(Key*) const;
+    // isCurrent - false if ticket should be renewed with current key
+    bool find(const unsigned char* name, Key*, bool* isCurrent) const;
+
+private:
+    mutable std::mutex _mutex;
+
+    Key _current;
+    bool _hasCurrent;
+    Key _previous;
+    bool _hasPrevious;
+};
+
+bool TicketKeys::rotate()
+{
+    Key key;
+    if(RAND_bytes(reinterpret_cast<unsigned char*>(&key), sizeof(key)) != 1)
+        return false;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _previous = _current;
+    _hasPrevious = _hasCurrent;
+    _current = key;
+    _hasCurrent = true;
+
+    return true;
+}
+
+bool TicketKeys::current(Key* key) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(!_hasCurrent)
+        return false;
+
+    *key = _current;
+
+    return true;
+}
+
+bool TicketKeys::find(const unsigned char* name, Key* key, bool* isCurrent) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_hasCurrent && 0 == memcmp(name, _current.name, sizeof(_current.name))) {
+        *key = _current;
+        *isCurrent = true;
+        return true;
+    }
+
+    if(_hasPrevious && 0 == memcmp(name, _previous.name, sizeof(_previous.name))) {
+        *key = _previous;
+        *isCurrent = false;
+        return true;
+    }
+
+    return false;
+}
+
+TicketKeys& SharedTicketKeys()
+{
+    static TicketKeys keys;
+    return keys;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX TicketMacCtx;
+
+bool InitTicketMac(EVP_MAC_CTX* macCtx, const TicketKeys::Key& key)
+{
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+        OSSL_PARAM_construct_end()
+    };
+
+    return 1 == EVP_MAC_init(macCtx, key.hmacKey, sizeof(key.hmacKey), params);
+}
+#else
+typedef HMAC_CTX TicketMacCtx;
+
+bool InitTicketMac(HMAC_CTX* hmacCtx, const TicketKeys::Key& key)
+{
+    return 1 == HMAC_Init_ex(hmacCtx, key.hmacKey, sizeof(key.hmacKey), EVP_sha256(), nullptr);
+}
+#endif
+
+int TicketKeyCallback(
+    SSL* /*ssl*/,
+    unsigned char* keyName,
+    unsigned char* iv,
+    EVP_CIPHER_CTX* cipherCtx,
+    TicketMacCtx* macCtx,
+    int encrypt)
+{
+    TicketKeys::Key key;
+
+    if(encrypt) {
+        if(!SharedTicketKeys().current(&key))
+            return -1;
+
+        if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+            return -1;
+
+        memcpy(keyName, key.name, sizeof(key.name));
+
+        if(!EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.aesKey, iv) ||
+           !InitTicketMac(macCtx, key))
+        {
+            return -1;
+        }
+
+        return 1;
+    }
+
+    bool isCurrent = false;
+    if(!SharedTicketKeys().find(keyName, &key, &isCurrent))
+        return 0; // unknown or expired key, full handshake is required
+
+    if(!InitTicketMac(macCtx, key) ||
+       !EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.aesKey, iv))
+    {
+        return -1;
+    }
+
+    return isCurrent ? 1 : 2; // 2 - issue new ticket with current key
+}
+
+// shared by all shards contexts the same way as ticket keys,
+// for devices which don't use tickets
+class SessionCache
+{
+public:
+    SessionCache() :
+        _sessions(TLS_SESSION_CACHE_SIZE, std::chrono::seconds(TLS_SESSION_TIMEOUT)) {}
+
+    void put(const std::string& id, const std::string& session);
+    bool find(const std::string& id, std::string* session);
+    void erase(const std::string& id);
+
+private:
+    std::mutex _mutex;
+
+    // session id -> DER encoded session
+    LruCache<std::string, std::string> _sessions;
+};
+
+void SessionCache::put(const std::string& id, const std::string& session)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _sessions.put(id, session);
+}
+
+bool SessionCache::find(const std::string& id, std::string* session)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const std::string* cached = _sessions.find(id);
+    if(!cached)
+        return false;
+
+    *session = *cached;
+
+    return true;
+}
+
+void SessionCache::erase(const std::string& id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _sessions.erase(id);
+}
+
+SessionCache& SharedSessionCache()
+{
+    static SessionCache cache;
+    return cache;
+}
+
+std::string SessionId(const SSL_SESSION* session)
+{
+    unsigned int idLength = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &idLength);
+
+    return std::string(reinterpret_cast<const char*>(id), idLength);
+}
+
+int NewSessionCallback(SSL* /*ssl*/, SSL_SESSION* session)
+{
+    const int size = i2d_SSL_SESSION(session, nullptr);
+    if(size <= 0)
+        return 0;
+
+    std::string der(size, '\0');
+    unsigned char* derData = reinterpret_cast<unsigned char*>(&der[0]);
+    if(i2d_SSL_SESSION(session, &derData) != size)
+        return 0;
+
+    SharedSessionCache().put(SessionId(session), der);
+
+    return 0; // reference to session is not kept
+}
+
+SSL_SESSION* GetSessionCallback(
+    SSL* /*ssl*/,
+    const unsigned char* id,
+    int idLength,
+    int* copy)
+{
+    *copy = 0;
+
+    std::string der;
+    if(!SharedSessionCache().find(std::string(reinterpret_cast<const char*>(id), idLength), &der))
+        return nullptr;
+
+    const unsigned char* derData = reinterpret_cast<const unsigned char*>(der.data());
+    return d2i_SSL_SESSION(nullptr, &derData, static_cast<long>(der.size()));
+}
+
+void RemoveSessionCallback(SSL_CTX* /*ctx*/, SSL_SESSION* session)
+{
+    SharedSessionCache().erase(SessionId(session));
+}
+
+const unsigned char SessionIdContext[] = "IpCamBox.ControlServer";
+
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ServerSecureContext::ServerSecureContext(const ::Server::Config::Config* config) :
     asio::ssl::context(asio::ssl::context::sslv23),
@@ -45,6 +310,12 @@ ServerSecureContext::ServerSecureContext(const ::Server::Config::Config* config)
         return;
     }
 
+    if(!setupHandshakePolicy())
+        return;
+
+    if(!setupSessionResumption())
+        return;
+
     if(!updateCertificate())
         return;
 
@@ -63,6 +334,70 @@ ServerSecureContext::ServerSecureContext(const ::Server::Config::Config* config)
     _valid = true;
 }
 
+bool ServerSecureContext::setupHandshakePolicy()
+{
+    SSL_CTX* ctx = native_handle();
+
+    if(!SSL_CTX_set_cipher_list(ctx, TLS_CIPHERS)) {
+        Log()->critical("SSL_CTX_set_cipher_list failed");
+        return false;
+    }
+
+    if(!SSL_CTX_set1_curves_list(ctx, TLS_CURVES)) {
+        Log()->critical("SSL_CTX_set1_curves_list failed");
+        return false;
+    }
+
+    SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    return true;
+}
+
+bool ServerSecureContext::setupSessionResumption()
+{
+    SSL_CTX* ctx = native_handle();
+
+    // required to resume sessions with verified client certificate
+    if(!SSL_CTX_set_session_id_context(
+        ctx, SessionIdContext, sizeof(SessionIdContext) - 1))
+    {
+        Log()->critical("SSL_CTX_set_session_id_context failed");
+        return false;
+    }
+
+    // connections are spread between shards contexts,
+    // so per context internal cache would miss most of resumptions,
+    // and the one shared by all shards is used instead
+    SSL_CTX_set_session_cache_mode(
+        ctx,
+        SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, NewSessionCallback);
+    SSL_CTX_sess_set_get_cb(ctx, GetSessionCallback);
+    SSL_CTX_sess_set_remove_cb(ctx, RemoveSessionCallback);
+    SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+
+#if TLS_SESSION_TICKETS
+    TicketKeys::Key key;
+    if(!SharedTicketKeys().current(&key)) {
+        Log()->critical("Failed to generate session ticket keys");
+        return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if(!SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, TicketKeyCallback)) {
+#else
+    if(!SSL_CTX_set_tlsext_ticket_key_cb(ctx, TicketKeyCallback)) {
+#endif
+        Log()->critical("Failed to set session ticket key callback");
+        return false;
+    }
+#else
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+#endif
+
+    return true;
+}
+
 const ::Server::Config::Config * ServerSecureContext::config()
 {
     return _config;
@@ -114,46 +449,123 @@ const std::shared_ptr<spdlog::logger>& Server::Log()
 Server::Server(
     asio::io_service* ioService,
     const ::Server::Config::Config* config) :
-    ServerSecureContext(config),
     NetworkCore::Server(ioService, config->serverConfig()->controlServerPort),
-    _updateCertificateTimer(*ioService)
+    _nextShard(0), _stopping(false),
+    _rotateTicketKeysTimer(*ioService)
 {
-    scheduleUpdateCertificate();
+    unsigned shardsCount = CONTROL_SERVER_SHARDS_COUNT;
+    if(!shardsCount)
+        shardsCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    Log()->info("Starting {} control server shards", shardsCount);
+
+    _shards.reserve(shardsCount);
+    for(unsigned i = 0; i < shardsCount; ++i)
+        _shards.emplace_back(new Shard(this, config));
+
+    for(auto& shard: _shards)
+        shard->run();
+
+    _admissionGate =
+        std::make_shared<AdmissionGate>(
+            ioService,
+            std::bind(
+                &Server::admitConnection, this,
+                std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+#if CONTROL_USE_TLS && TLS_SESSION_TICKETS
+    scheduleRotateTicketKeys();
+#endif
 }
 
-void Server::scheduleUpdateCertificate()
+Server::~Server()
 {
-    Log()->info("Scheduling update certificate within {} days", UPDATE_CERTIFICATE_TIMEOUT);
+    _stopping = true;
+
+    _admissionGate.reset();
 
-    _updateCertificateTimer.expires_from_now(std::chrono::minutes(UPDATE_CERTIFICATE_TIMEOUT));
-    _updateCertificateTimer.async_wait(
+    for(auto& shard: _shards)
+        shard->stop();
+
+    _shards.clear();
+}
+
+void Server::scheduleRotateTicketKeys()
+{
+    _rotateTicketKeysTimer.expires_from_now(
+        std::chrono::seconds(TLS_TICKET_KEYS_ROTATION_INTERVAL));
+    _rotateTicketKeysTimer.async_wait(
         [this] (const asio::error_code& error) {
             if(error)
                 return;
 
-            updateCertificate();
+            if(SharedTicketKeys().rotate())
+                Log()->info("Session ticket keys rotated");
+            else
+                Log()->error("Failed to rotate session ticket keys");
+
+            scheduleRotateTicketKeys();
+        }
+    );
+}
+
+Shard* Server::ownerShard(const DeviceId& deviceId) const
+{
+    const size_t shardIndex = std::hash<DeviceId>()(deviceId) % _shards.size();
+    return _shards[shardIndex].get();
+}
+
+void Server::postToOwnerShard(
+    const DeviceId& deviceId,
+    const std::function<void (Shard&)>& action)
+{
+    if(_stopping)
+        return;
 
-            scheduleUpdateCertificate();
+    Shard* shard = ownerShard(deviceId);
+    shard->ioService()->post(
+        [shard, action] () {
+            action(*shard);
+        }
+    );
+}
+
+void Server::postToSessionContext(
+    const DeviceId& deviceId,
+    const std::function<void (SessionContext&)>& action)
+{
+    postToOwnerShard(deviceId,
+        [deviceId, action] (Shard& shard) {
+            action(shard.sessions()->get(deviceId));
         }
     );
 }
 
 void Server::onNewConnection(const std::shared_ptr<asio::ip::tcp::socket>& socket)
 {
-    if(!valid()) {
-        Log()->critical("Can't accept incoming connectin in invalid state.");
+    asio::error_code error;
+    const asio::ip::tcp::endpoint remoteEndpoint = socket->remote_endpoint(error);
+    if(error) {
+        Log()->debug("Connection lost before admission: {}", error.message());
         return;
     }
 
     Log()->trace(
         ">> Server::onNewConnection. ip: {}",
-        socket->remote_endpoint().address().to_string());
+        remoteEndpoint.address().to_string());
+
+    _admissionGate->enqueue(socket);
+}
 
-    std::shared_ptr<ServerSession> session =
-        std::make_shared<ServerSession>(
-            ioService(), config(), &_sessions,
-            socket, static_cast<ServerSession::SecureContext*>(this));
-    session->handshake();
+void Server::admitConnection(
+    const std::shared_ptr<asio::ip::tcp::socket>& socket,
+    const AdmissionGate::Ticket& ticket,
+    bool overloaded)
+{
+    Shard* shard = _shards[_nextShard].get();
+    _nextShard = (_nextShard + 1) % _shards.size();
+
+    shard->accept(socket, ticket, _admissionGate->retryAfterHint(), overloaded);
 }
 
 void Server::requestStream(
@@ -161,40 +573,68 @@ void Server::requestStream(
     const SourceId& sourceId,
     const StreamDst& dst)
 {
-    SessionContext& sessionContext = _sessions.get(deviceId);
-
-    sessionContext.streamRequested(sourceId, dst);
-
-    if(ServerSession* session = sessionContext.activeSession()) {
-        Log()->debug(
-            "Requesting stream. deviceId: {}, sourceId: {}, streamDst: {}",
-            deviceId, sourceId, dst);
-
-        session->requestStream(sourceId);
-    } else
-        Log()->debug(
-            "Requested stream for not connected device {}, sourceId: {}",
-            deviceId, sourceId);
+    postToSessionContext(deviceId,
+        [deviceId, sourceId, dst] (SessionContext& sessionContext) {
+            sessionContext.streamRequested(sourceId, dst);
+
+            const bool connected =
+                sessionContext.postToActiveSession(
+                    [sourceId, dst] (ServerSession& session) {
+                        session.requestStream(sourceId, dst);
+                    }
+                );
+
+            if(connected) {
+                Log()->debug(
+                    "Requesting stream. deviceId: {}, sourceId: {}, streamDst: {}",
+                    deviceId, sourceId, dst);
+            } else {
+                Log()->debug(
+                    "Requested stream for not connected device {}, sourceId: {}",
+                    deviceId, sourceId);
+            }
+        }
+    );
 }
 
 void Server::stopStream(
     const DeviceId& deviceId,
     const SourceId& sourceId)
 {
-    SessionContext& sessionContext = _sessions.get(deviceId);
-
-    sessionContext.stopStreamRequested(sourceId);
-
-    if(ServerSession* session = sessionContext.activeSession()) {
-        Log()->debug(
-            "Requesting stream stop. deviceId: {}, sourceId: {}",
-            deviceId, sourceId);
+    postToSessionContext(deviceId,
+        [deviceId, sourceId] (SessionContext& sessionContext) {
+            sessionContext.stopStreamRequested(sourceId);
+
+            const bool connected =
+                sessionContext.postToActiveSession(
+                    [sourceId] (ServerSession& session) {
+                        session.stopStream(sourceId);
+                    }
+                );
+
+            if(connected) {
+                Log()->debug(
+                    "Requesting stream stop. deviceId: {}, sourceId: {}",
+                    deviceId, sourceId);
+            } else {
+                Log()->debug(
+                    "Requested stream stop for not connected device {}, sourceId: {}",
+                    deviceId, sourceId);
+            }
+        }
+    );
+}
 
-        session->stopStream(sourceId);
-    } else
-        Log()->debug(
-            "Requested stream stop for not connected device {}, sourceId: {}",
-            deviceId, sourceId);
+void Server::requestSnapshot(
+    const DeviceId& deviceId,
+    const SourceId& sourceId,
+    const SnapshotCallback& callback)
+{
+    postToOwnerShard(deviceId,
+        [deviceId, sourceId, callback] (Shard& shard) {
+            shard.requestSnapshot(deviceId, sourceId, callback);
+        }
+    );
 }
 
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <vector>
+#include <atomic>
+
 #include <asio/ssl.hpp>
 
 #include <CxxPtr/OpenSSLPtr.h>
@@ -10,24 +13,31 @@
 #include "NetworkCore/server.h"
 #include "Config/Config.h"
 #include "Sessions.h"
+#include "AdmissionGate.h"
 
 
 namespace ControlServer
 {
 
+class Shard;
+
 ///////////////////////////////////////////////////////////////////////////////
 class ServerSecureContext : public asio::ssl::context
 {
 public:
     ServerSecureContext(const ::Server::Config::Config*);
 
-protected:
-    const ::Server::Config::Config * config();
-
     bool valid() const;
 
     bool updateCertificate();
 
+protected:
+    const ::Server::Config::Config * config();
+
+private:
+    bool setupHandshakePolicy();
+    bool setupSessionResumption();
+
 private:
     const ::Server::Config::Config *const _config;
 
@@ -36,27 +46,50 @@ private:
 
 
 ///////////////////////////////////////////////////////////////////////////////
-class Server : private ServerSecureContext, public NetworkCore::Server
+class Server : public NetworkCore::Server
 {
 public:
     Server(
         asio::io_service* ioService,
         const ::Server::Config::Config*);
+    ~Server();
 
+    // could be called from any thread
     void requestStream(const DeviceId&, const SourceId&, const StreamDst&);
     void stopStream(const DeviceId&, const SourceId&);
 
+    typedef std::function<void (bool success, const std::string& jpeg)> SnapshotCallback;
+    // could be called from any thread, callback is called from shard's thread
+    void requestSnapshot(const DeviceId&, const SourceId&, const SnapshotCallback&);
+
+    // runs action in thread of shard owning device context
+    void postToOwnerShard(const DeviceId&, const std::function<void (Shard&)>& action);
+    void postToSessionContext(const DeviceId&, const std::function<void (SessionContext&)>& action);
+
 protected:
     void onNewConnection(const std::shared_ptr<asio::ip::tcp::socket>& socket) override;
 
 private:
     static inline const std::shared_ptr<spdlog::logger>& Log();
 
-    void scheduleUpdateCertificate();
+    Shard* ownerShard(const DeviceId&) const;
+
+    void scheduleRotateTicketKeys();
+
+    void admitConnection(
+        const std::shared_ptr<asio::ip::tcp::socket>&,
+        const AdmissionGate::Ticket&,
+        bool overloaded);
 
 private:
-    asio::steady_timer _updateCertificateTimer;
-    Sessions _sessions;
+    std::vector<std::unique_ptr<Shard>> _shards;
+    unsigned _nextShard;
+
+    std::shared_ptr<AdmissionGate> _admissionGate;
+
+    std::atomic<bool> _stopping;
+
+    asio::steady_timer _rotateTicketKeysTimer;
 };
 
 }
@@ -1,8 +1,11 @@
 #include "ServerSession.h"
 
+#include <cmath>
+
 #include <Common/Hash.h>
 
-#include "Sessions.h"
+#include "Server.h"
+#include "Shard.h"
 
 
 namespace ControlServer
@@ -16,16 +19,36 @@ const std::shared_ptr<spdlog::logger>& ServerSession::Log()
 ServerSession::ServerSession(
     asio::io_service* ioService,
     const ::Server::Config::Config* config,
-    Sessions* sessions,
+    Server* server,
+    const AdmissionGate::Ticket& admissionTicket,
+    unsigned retryAfter,
+    bool overloaded,
+    const asio::ip::address& clientIp,
     const std::shared_ptr<asio::ip::tcp::socket>& socket,
     SecureContext* context) :
     NetworkCore::ServerSession(socket, context),
     _ioService(ioService),
-    _requestStreamTimer(*ioService),
+    _timeoutTimer(*ioService),
+    _heartbeatTimer(*ioService),
+    _admissionTicket(admissionTicket),
+    _retryAfter(retryAfter),
+    _overloaded(overloaded),
+    _greetingReceived(false),
+    _rejected(false),
+    _rejectRetryAfter(0),
+    _supportsRejected(false),
+    _batchMessages(false),
+    _supportsSnapshots(false),
+    _pendingBatchType(Protocol::EmptyMessage),
+    _flushScheduled(false),
+    _pingSequence(0),
+    _missedHeartbeats(0),
+    _rttSamples(0),
+    _rtt(0),
+    _rttJitter(0),
     _config(config),
-    _sessions(sessions),
-    _clientIp(socket->remote_endpoint().address()),
-    _sessionContext(nullptr)
+    _server(server),
+    _clientIp(clientIp)
 {
     Log()->info("Session created. Client ip: {}", _clientIp.to_string());
 
@@ -39,19 +62,132 @@ ServerSession::ServerSession(
         Log()->critical("set_verify_callback failed: {}", error.message());
         return;
     }
+
+    _timeoutTimer.expires_from_now(std::chrono::seconds(HANDSHAKE_TIMEOUT));
+    _timeoutTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            Log()->error("Handshake timeout. Client ip: {}", _clientIp.to_string());
+
+            close();
+        }
+    );
 }
 
 ServerSession::~ServerSession()
 {
-    assert(_deviceId.empty() == (_sessionContext == nullptr));
-
     Log()->info(
         "Session destroying. Client ip: {}, deviceId: {}",
         _clientIp.to_string(),
         _deviceId);
 
-    if(!_deviceId.empty())
-        _sessionContext->destroyed(_deviceId);
+    if(_rttSamples) {
+        Log()->info(
+            "Session stats. DeviceId: {}, rtt: {:.1f} ms, jitter: {:.1f} ms",
+            _deviceId, _rtt, _rttJitter);
+    }
+
+    if(!_device.id.empty()) {
+        const DeviceId deviceId = _device.id;
+        const ServerSession* session = this;
+        _server->postToSessionContext(deviceId,
+            [deviceId, session] (SessionContext& sessionContext) {
+                sessionContext.destroyed(deviceId, session);
+            }
+        );
+    }
+}
+
+std::weak_ptr<ServerSession> ServerSession::weakThis()
+{
+    return std::static_pointer_cast<ServerSession>(shared_from_this());
+}
+
+void ServerSession::close()
+{
+    _heartbeatTimer.cancel();
+
+    asio::error_code error;
+    secureStream().lowest_layer().close(error);
+}
+
+void ServerSession::scheduleHeartbeat()
+{
+    _heartbeatTimer.expires_from_now(std::chrono::seconds(HEARTBEAT_INTERVAL));
+    _heartbeatTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            sendHeartbeat();
+        }
+    );
+}
+
+void ServerSession::sendHeartbeat()
+{
+    // closed connection fails pending read, so session is destroyed
+    // and owner shard forgets it without waiting for TCP timeout
+    if(_missedHeartbeats >= HEARTBEAT_MAX_MISSED) {
+        Log()->error(
+            "Device is not responding. Device: {}, missed heartbeats: {}",
+            _deviceId, _missedHeartbeats);
+        close();
+        return;
+    }
+
+    ++_missedHeartbeats;
+
+    const auto now =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch());
+
+    Protocol::Ping ping;
+    ping.set_sequence(++_pingSequence);
+    ping.set_timestamp(now.count());
+
+    sendMessage(Protocol::PingMessage, ping);
+
+    scheduleHeartbeat();
+}
+
+void ServerSession::reject(unsigned retryAfter)
+{
+    _rejected = true;
+    _rejectRetryAfter = retryAfter;
+
+    _heartbeatTimer.cancel();
+
+    if(_greetingReceived)
+        sendRejected();
+
+    // give device a chance to greet, get message and disconnect by itself
+    auto self = shared_from_this();
+    _timeoutTimer.expires_from_now(std::chrono::seconds(REJECT_CLOSE_TIMEOUT));
+    _timeoutTimer.async_wait(
+        [self, this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            close();
+        }
+    );
+}
+
+void ServerSession::sendRejected()
+{
+    // old devices don't know Rejected, so just disconnect them
+    if(!_supportsRejected) {
+        close();
+        return;
+    }
+
+    Protocol::Rejected message;
+    message.set_retryafter(_rejectRetryAfter);
+
+    sendMessage(Protocol::RejectedMessage, message);
 }
 
 bool ServerSession::verifyClient(
@@ -79,36 +215,109 @@ bool ServerSession::verifyClient(
     return true;
 }
 
+bool ServerSession::verifyResumedClient()
+{
+    // session was verified when it was established,
+    // but device could be removed from config since then
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    X509Ptr clientCertPtr(SSL_get1_peer_certificate(secureStream().native_handle()));
+#else
+    X509Ptr clientCertPtr(SSL_get_peer_certificate(secureStream().native_handle()));
+#endif
+    X509* clientCert = clientCertPtr.get();
+    if(!clientCert) {
+        Log()->error("Resumed session has no client certificate");
+        return false;
+    }
+
+    std::string name;
+    if(!_config->authenticate(clientCert, &name))
+        return false;
+
+    if(name.empty()) {
+        Log()->error("Empty device Id");
+        return false;
+    }
+
+    _deviceId = name;
+
+    return true;
+}
+
 void ServerSession::onConnected(const asio::error_code& errorCode)
 {
     NetworkCore::ServerSession::onConnected(errorCode);
 
+    _timeoutTimer.cancel();
+    _admissionTicket.reset();
+
     if(errorCode)
         return;
 
+#if CONTROL_USE_TLS
+    // verify callback is not called on session resumption
+    if(_deviceId.empty() && SSL_session_reused(secureStream().native_handle())) {
+        if(!verifyResumedClient()) {
+            close();
+            return;
+        }
+    }
+#endif
+
     Log()->info(
         "Secure channel established. Client ip: {}, DeviceId: {}",
         _clientIp.to_string(), _deviceId);
 
-    ::Server::Config::Device device;
-    if(!_config->findDevice(_deviceId, &device)) {
-        Log()->error("Unknown device. Device: {}", _deviceId);
+    if(_overloaded) {
+        Log()->info("Server is overloaded. Device: {}", _deviceId);
+        reject(_retryAfter);
+        // to get device's greeting
+        readMessageAsync();
         return;
     }
 
-    SessionContext& sessionContext = _sessions->get(_deviceId);
-    if(sessionContext.activeSession()) {
-        Log()->error("Device already connected. Device: {}", _deviceId);
+    ::Server::Config::Device device;
+    if(!_config->findDevice(_deviceId, &device)) {
+        Log()->error("Unknown device. Device: {}", _deviceId);
+        reject(UNKNOWN_DEVICE_RETRY_AFTER);
+        // to get device's greeting
+        readMessageAsync();
         return;
     }
 
     _device = device;
-    _sessionContext = &sessionContext;
-    _sessionContext->authenticated(_deviceId, this);
+
+    // device context lives on it's owner shard,
+    // messages sent to it later will be handled in the same order
+    const DeviceId deviceId = _deviceId;
+    const ServerSession* session = this;
+    const std::weak_ptr<ServerSession> sessionRef = weakThis();
+    asio::io_service* sessionIoService = _ioService;
+    _server->postToSessionContext(deviceId,
+        [deviceId, session, sessionRef, sessionIoService] (SessionContext& sessionContext) {
+            const bool accepted =
+                sessionContext.authenticated(deviceId, session, sessionRef, sessionIoService);
+            PostToSession(sessionIoService, sessionRef,
+                [accepted] (ServerSession& session) {
+                    session.onAuthenticated(accepted);
+                }
+            );
+        }
+    );
 
     readMessageAsync();
 }
 
+void ServerSession::onAuthenticated(bool accepted)
+{
+    if(accepted)
+        return;
+
+    Log()->error("Device already connected. Device: {}", _deviceId);
+
+    reject(ALREADY_CONNECTED_RETRY_AFTER);
+}
+
 void ServerSession::onWriteFail(MessageType messageType, const std::string& message, const asio::error_code& errorCode)
 {
     NetworkCore::ServerSession::onWriteFail(messageType, message, errorCode);
@@ -127,6 +336,10 @@ void ServerSession::onMessage(
         return;
     }
 
+    // only greeting is expected from rejected device
+    if(_rejected && type != Protocol::ClientGreetingMessage)
+        return;
+
     if(parseMessage(type, body))
         readMessageAsync();
 }
@@ -134,9 +347,8 @@ void ServerSession::onMessage(
 template<typename MessageType>
 bool ServerSession::parseMessage(const std::string& body)
 {
-    MessageType message;
-    if(message.ParseFromString(body))
-        return onMessage(message);
+    if(const MessageType* message = _messageParser.parse<MessageType>(body))
+        return onMessage(*message);
 
     assert(false);
 
@@ -154,6 +366,12 @@ bool ServerSession::parseMessage(MessageType type, const std::string& body)
             return parseMessage<Protocol::ClientReady>(body);
         case Protocol::StreamStatusMessage:
             return parseMessage<Protocol::StreamStatus>(body);
+        case Protocol::StreamStatusesMessage:
+            return parseMessage<Protocol::StreamStatuses>(body);
+        case Protocol::PongMessage:
+            return parseMessage<Protocol::Pong>(body);
+        case Protocol::SnapshotMessage:
+            return parseMessage<Protocol::Snapshot>(body);
         default:
             assert(false);
             return false; // unknown message
@@ -162,18 +380,43 @@ bool ServerSession::parseMessage(MessageType type, const std::string& body)
 
 void ServerSession::sendMessage(Protocol::MessageType messageType, const Message& message)
 {
-    std::string messageBody = message.SerializeAsString();
-    writeMessageAsync(messageType, &messageBody);
+    // writeMessageAsync swaps buffer content,
+    // so buffer given back is reused for next message
+    Protocol::SerializeMessage(message, &_writeBuffer);
+    writeMessageAsync(messageType, &_writeBuffer);
 }
 
 bool ServerSession::onMessage(const Protocol::ClientGreeting& message)
 {
     Log()->debug("Got ClientGreeting");
 
+    _greetingReceived = true;
+    _supportsRejected = message.supportsrejected();
+
+    if(_rejected) {
+        sendRejected();
+        return false;
+    }
+
+    _batchMessages = message.supportsbatches();
+    _supportsSnapshots = message.supportssnapshots();
+
     Protocol::ServerGreeting reply;
+    if(_retryAfter)
+        reply.set_retryafter(_retryAfter);
+    reply.set_supportsbatches(true);
+
+    // old devices don't know Ping
+    if(message.supportsheartbeats()) {
+        reply.set_heartbeatinterval(HEARTBEAT_INTERVAL);
+        reply.set_heartbeatmaxmissed(HEARTBEAT_MAX_MISSED);
+    }
 
     sendMessage(Protocol::ServerGreetingMessage, reply);
 
+    if(message.supportsheartbeats())
+        scheduleHeartbeat();
+
     return true;
 }
 
@@ -186,25 +429,29 @@ bool ServerSession::onMessage(const Protocol::ClientConfigRequest& message)
         return false;
     }
 
-    Protocol::ClientConfigReply reply;
-
-    Protocol::ClientConfig& config = *(reply.mutable_config());
-
-    Protocol::DropboxConfig& dropbox = *config.mutable_dropbox();
-    dropbox.set_token(_device.dropboxToken);
-
-    _config->enumDeviceSources(_device.id,
-        [&config] (const ::Server::Config::Source& sourceConfig) -> bool {
-            Protocol::VideoSource& source = *(config.add_sources());
-            source.set_id(sourceConfig.id);
-            source.set_uri(sourceConfig.uri);
-            source.set_dropboxmaxstorage(sourceConfig.dropboxMaxStorage);
-            return true;
+    const DeviceId deviceId = _device.id;
+    const std::weak_ptr<ServerSession> sessionRef = weakThis();
+    asio::io_service* sessionIoService = _ioService;
+    _server->postToOwnerShard(deviceId,
+        [deviceId, sessionRef, sessionIoService] (Shard& shard) {
+            const std::string* reply = shard.clientConfigCache()->reply(deviceId);
+            if(!reply) {
+                Log()->error("Failed to build client config. Device: {}", deviceId);
+                return;
+            }
+
+            // the only copy of cached reply,
+            // it's content is handed over to writer as is
+            const std::shared_ptr<std::string> replyBody =
+                std::make_shared<std::string>(*reply);
+            PostToSession(sessionIoService, sessionRef,
+                [replyBody] (ServerSession& session) {
+                    session.writeMessageAsync(Protocol::ClientConfigReplyMessage, replyBody.get());
+                }
+            );
         }
     );
 
-    sendMessage(Protocol::ClientConfigReplyMessage, reply);
-
     return true;
 }
 
@@ -212,18 +459,38 @@ bool ServerSession::onMessage(const Protocol::ClientReady&)
 {
     Log()->debug("Got ClientReady");
 
-    if(!_sessionContext) {
-        Log()->error("No session context");
+    if(_device.id.empty()) {
+        Log()->error("Not authenticated");
         return false;
     }
 
-    _sessionContext->enumActiveStreams(
-        [this] (const SourceId& sourceId, const StreamDst&) {
-            Log()->debug(
-                "Restoring stream for source \"{}\"",
-                 sourceId);
-            _ioService->post(std::bind(&ServerSession::requestStream, this, sourceId));
-            return true;
+    const ServerSession* session = this;
+    _server->postToSessionContext(_device.id,
+        [session] (SessionContext& sessionContext) {
+            if(!sessionContext.isActiveSession(session))
+                return;
+
+            std::vector<std::pair<SourceId, StreamDst>> streams;
+            sessionContext.enumActiveStreams(
+                [&streams] (const SourceId& sourceId, const StreamDst& dst) {
+                    Log()->debug(
+                        "Restoring stream for source \"{}\"",
+                         sourceId);
+                    streams.emplace_back(sourceId, dst);
+                    return true;
+                }
+            );
+
+            if(streams.empty())
+                return;
+
+            // all requests in single handler to let them be batched
+            sessionContext.postToActiveSession(
+                [streams] (ServerSession& session) {
+                    for(const auto& stream: streams)
+                        session.requestStream(stream.first, stream.second);
+                }
+            );
         }
     );
 
@@ -234,50 +501,143 @@ bool ServerSession::onMessage(const Protocol::StreamStatus& message)
 {
     Log()->debug("Got StreamStatus");
 
-    if(!_sessionContext) {
-        Log()->error("No session context");
+    if(_device.id.empty()) {
+        Log()->error("Not authenticated");
+        return false;
+    }
+
+    onStreamStatuses({ { message.sourceid(), message.success() } });
+
+    return true;
+}
+
+bool ServerSession::onMessage(const Protocol::StreamStatuses& message)
+{
+    Log()->debug("Got StreamStatuses");
+
+    if(_device.id.empty()) {
+        Log()->error("Not authenticated");
         return false;
     }
 
-    if(message.success())
-        Log()->debug("{} is streaming", message.sourceid());
-    else {
-        const SourceId sourceId = message.sourceid();
-        Log()->debug("{} is NOT streaming", message.sourceid());
+    std::vector<std::pair<SourceId, bool>> statuses;
+    statuses.reserve(message.statuses_size());
+    for(const Protocol::StreamStatus& status: message.statuses())
+        statuses.emplace_back(status.sourceid(), status.success());
 
-        if(_sessionContext->shouldStream(message.sourceid())) {
-            Log()->debug("Schedule {} streaming", message.sourceid());
+    onStreamStatuses(statuses);
 
-            _requestStreamTimer.expires_from_now(std::chrono::seconds(10));
-            _requestStreamTimer.async_wait(
-                [this, sourceId] (const asio::error_code& error) {
-                    if(error)
-                        return;
+    return true;
+}
 
-                    requestStream(sourceId);
-                }
-            );
+bool ServerSession::onMessage(const Protocol::Pong& message)
+{
+    const auto now =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch());
+
+    const double rtt = (now.count() - static_cast<int64_t>(message.timestamp())) / 1000.;
+    if(rtt < 0) {
+        Log()->error("Invalid Pong timestamp. Device: {}", _deviceId);
+        return false;
+    }
+
+    _missedHeartbeats = 0;
+
+    // the same smoothing as TCP uses for it's RTO (RFC 6298)
+    if(!_rttSamples) {
+        _rtt = rtt;
+        _rttJitter = rtt / 2;
+    } else {
+        _rttJitter = 0.75 * _rttJitter + 0.25 * std::fabs(_rtt - rtt);
+        _rtt = 0.875 * _rtt + 0.125 * rtt;
+    }
+    ++_rttSamples;
+
+    Log()->trace(
+        "Got Pong #{}. Device: {}, rtt: {:.1f} ms, srtt: {:.1f} ms, jitter: {:.1f} ms",
+        message.sequence(), _deviceId, rtt, _rtt, _rttJitter);
+
+    const ServerSession* session = this;
+    const double srtt = _rtt;
+    const double rttJitter = _rttJitter;
+    _server->postToSessionContext(_deviceId,
+        [session, srtt, rttJitter] (SessionContext& sessionContext) {
+            sessionContext.heartbeat(session, srtt, rttJitter);
         }
+    );
+
+    return true;
+}
+
+bool ServerSession::onMessage(const Protocol::Snapshot& message)
+{
+    Log()->debug("Got Snapshot");
+
+    if(_device.id.empty()) {
+        Log()->error("Not authenticated");
+        return false;
     }
 
+    const DeviceId deviceId = _device.id;
+    const SourceId sourceId = message.sourceid();
+    const bool success = message.success();
+    const std::string jpeg = message.jpeg();
+    const ServerSession* session = this;
+    _server->postToOwnerShard(deviceId,
+        [deviceId, sourceId, success, jpeg, session] (Shard& shard) {
+            SessionContext& sessionContext = shard.sessions()->get(deviceId);
+            if(!sessionContext.isActiveSession(session))
+                return;
+
+            shard.snapshotCaptured(deviceId, sourceId, success, jpeg);
+        }
+    );
+
     return true;
 }
 
-void ServerSession::requestStream(const SourceId& sourceId)
+void ServerSession::onStreamStatuses(const std::vector<std::pair<SourceId, bool>>& statuses)
+{
+    for(const auto& status: statuses) {
+        if(status.second)
+            Log()->debug("{} is streaming", status.first);
+        else
+            Log()->debug("{} is NOT streaming", status.first);
+    }
+
+    const DeviceId deviceId = _device.id;
+    const ServerSession* session = this;
+    _server->postToOwnerShard(deviceId,
+        [deviceId, statuses, session] (Shard& shard) {
+            SessionContext& sessionContext = shard.sessions()->get(deviceId);
+            if(!sessionContext.isActiveSession(session))
+                return;
+
+            for(const auto& status: statuses)
+                shard.streamStatus(deviceId, status.first, status.second);
+        }
+    );
+}
+
+void ServerSession::requestStream(const SourceId& sourceId, const StreamDst& dst)
 {
-    StreamDst dst;
-    if(_sessionContext->shouldStream(sourceId, &dst)) {
-        Protocol::RequestStream requestStream;
-        requestStream.set_sourceid(sourceId);
-        requestStream.set_destination(dst);
+    Protocol::RequestStream requestStream;
+    requestStream.set_sourceid(sourceId);
+    requestStream.set_destination(dst);
 
-        Log()->debug(
-            "Requesting stream from {} to {}",
-            requestStream.sourceid(),
-            requestStream.destination());
+    Log()->debug(
+        "Requesting stream from {} to {}",
+        requestStream.sourceid(),
+        requestStream.destination());
 
+    if(!_batchMessages) {
         sendMessage(Protocol::RequestStreamMessage, requestStream);
+        return;
     }
+
+    queueMessage(Protocol::RequestStreamsMessage);
+    _pendingRequestStreams.add_streams()->Swap(&requestStream);
 }
 
 void ServerSession::stopStream(const SourceId& sourceId)
@@ -285,7 +645,86 @@ void ServerSession::stopStream(const SourceId& sourceId)
     Protocol::StopStream stopStream;
     stopStream.set_sourceid(sourceId);
 
-    sendMessage(Protocol::StopStreamMessage, stopStream);
+    if(!_batchMessages) {
+        sendMessage(Protocol::StopStreamMessage, stopStream);
+        return;
+    }
+
+    queueMessage(Protocol::StopStreamsMessage);
+    _pendingStopStreams.add_streams()->Swap(&stopStream);
+}
+
+void ServerSession::requestSnapshot(const SourceId& sourceId)
+{
+    if(!_supportsSnapshots) {
+        Log()->debug("Device doesn't support snapshots. Device: {}", _deviceId);
+
+        const DeviceId deviceId = _device.id;
+        _server->postToOwnerShard(deviceId,
+            [deviceId, sourceId] (Shard& shard) {
+                shard.snapshotCaptured(deviceId, sourceId, false, std::string());
+            }
+        );
+        return;
+    }
+
+    Log()->debug("Requesting snapshot of {}. Device: {}", sourceId, _deviceId);
+
+    Protocol::RequestSnapshot requestSnapshot;
+    requestSnapshot.set_sourceid(sourceId);
+
+    flushPendingMessages();
+    sendMessage(Protocol::RequestSnapshotMessage, requestSnapshot);
+}
+
+void ServerSession::configUpdated(std::string* reply)
+{
+    Log()->debug("Sending ClientConfigUpdated. Device: {}", _deviceId);
+
+    // ClientConfigReply and ClientConfigUpdated have the same layout,
+    // so cached reply is sent as is
+    flushPendingMessages();
+    writeMessageAsync(Protocol::ClientConfigUpdatedMessage, reply);
+}
+
+void ServerSession::queueMessage(Protocol::MessageType batchType)
+{
+    // batch of other type should be sent first to keep messages order
+    if(_pendingBatchType != batchType)
+        flushPendingMessages();
+
+    _pendingBatchType = batchType;
+
+    if(_flushScheduled)
+        return;
+
+    // messages queued during current event loop iteration
+    // will be sent with single write
+    _flushScheduled = true;
+    PostToSession(_ioService, weakThis(),
+        [] (ServerSession& session) {
+            session._flushScheduled = false;
+            session.flushPendingMessages();
+        }
+    );
+}
+
+void ServerSession::flushPendingMessages()
+{
+    switch(_pendingBatchType) {
+        case Protocol::RequestStreamsMessage:
+            sendMessage(Protocol::RequestStreamsMessage, _pendingRequestStreams);
+            _pendingRequestStreams.Clear();
+            break;
+        case Protocol::StopStreamsMessage:
+            sendMessage(Protocol::StopStreamsMessage, _pendingStopStreams);
+            _pendingStopStreams.Clear();
+            break;
+        default:
+            break;
+    }
+
+    _pendingBatchType = Protocol::EmptyMessage;
 }
 
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <vector>
+#include <utility>
+
 #include "NetworkCore/session.h"
 #include "Protocol/protocol.h"
 
@@ -7,21 +10,32 @@
 
 #include "Log.h"
 #include "Config/Config.h"
+#include "AdmissionGate.h"
 
 
 namespace ControlServer
 {
 
-class Sessions;
-class SessionContext;
+class Server;
 
 class ServerSession : public NetworkCore::ServerSession
 {
 public:
+    enum {
+        HANDSHAKE_TIMEOUT = 10, // seconds
+        REJECT_CLOSE_TIMEOUT = 5, // seconds
+        UNKNOWN_DEVICE_RETRY_AFTER = 60 * 60, // seconds
+        ALREADY_CONNECTED_RETRY_AFTER = 30, // seconds
+    };
+
     ServerSession(
         asio::io_service* ioService,
         const ::Server::Config::Config* config,
-        Sessions*,
+        Server*,
+        const AdmissionGate::Ticket&,
+        unsigned retryAfter,
+        bool overloaded,
+        const asio::ip::address& clientIp,
         const std::shared_ptr<asio::ip::tcp::socket>& socket,
         SecureContext*);
     ~ServerSession();
@@ -29,8 +43,13 @@ public:
     void onMessage(MessageType, const std::string&, const asio::error_code&) override;
     void onWriteFail(MessageType, const std::string&, const asio::error_code&) override;
 
-    void requestStream(const SourceId&);
+    void requestStream(const SourceId&, const StreamDst&);
     void stopStream(const SourceId&);
+    // result is delivered to owner shard with Shard::snapshotCaptured
+    void requestSnapshot(const SourceId&);
+
+    // serialized ClientConfigReply, content is taken
+    void configUpdated(std::string* reply);
 
 private:
     static inline const std::shared_ptr<spdlog::logger>& Log();
@@ -38,11 +57,29 @@ private:
     bool verifyClient(
         bool preverified,
         asio::ssl::verify_context&);
+    bool verifyResumedClient();
     void onConnected(const asio::error_code& errorCode) override;
+    void onAuthenticated(bool accepted);
+
+    std::weak_ptr<ServerSession> weakThis();
+
+    // tells device when to try again and closes connection,
+    // Rejected is sent only after device's greeting is received
+    // since it's not known to old devices
+    void reject(unsigned retryAfter);
+    void sendRejected();
+    void close();
+
+    void scheduleHeartbeat();
+    void sendHeartbeat();
+
 
     typedef google::protobuf::MessageLite Message;
     void sendMessage(Protocol::MessageType, const Message&);
 
+    void queueMessage(Protocol::MessageType batchType);
+    void flushPendingMessages();
+
     template<typename MessageType>
     bool parseMessage(const std::string& body);
     bool parseMessage(MessageType type, const std::string& body);
@@ -51,19 +88,49 @@ private:
     bool onMessage(const Protocol::ClientConfigRequest&);
     bool onMessage(const Protocol::ClientReady&);
     bool onMessage(const Protocol::StreamStatus&);
+    bool onMessage(const Protocol::StreamStatuses&);
+    bool onMessage(const Protocol::Pong&);
+    bool onMessage(const Protocol::Snapshot&);
+    void onStreamStatuses(const std::vector<std::pair<SourceId, bool>>&);
 
 private:
     asio::io_service* _ioService;
-    asio::steady_timer _requestStreamTimer;
+    asio::steady_timer _timeoutTimer;
+    asio::steady_timer _heartbeatTimer;
+
+    AdmissionGate::Ticket _admissionTicket;
+    const unsigned _retryAfter;
+    // admitted over capacity only to get reconnect hint
+    const bool _overloaded;
+
+    bool _greetingReceived;
+    bool _rejected;
+    unsigned _rejectRetryAfter;
+    bool _supportsRejected;
+
+    Protocol::MessageParser _messageParser;
+    std::string _writeBuffer;
+
+    bool _batchMessages;
+    bool _supportsSnapshots;
+    Protocol::MessageType _pendingBatchType;
+    bool _flushScheduled;
+    Protocol::RequestStreams _pendingRequestStreams;
+    Protocol::StopStreams _pendingStopStreams;
+
+    unsigned _pingSequence;
+    unsigned _missedHeartbeats;
+    unsigned _rttSamples;
+    double _rtt; // smoothed, milliseconds
+    double _rttJitter; // mean deviation of rtt, milliseconds
 
     const ::Server::Config::Config *const _config;
 
-    Sessions* _sessions;
+    Server* _server;
     asio::ip::address _clientIp;
 
     DeviceId _deviceId;
     ::Server::Config::Device _device;
-    SessionContext *_sessionContext;
 
     std::string _nonce;
 };
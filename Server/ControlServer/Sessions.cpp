@@ -6,44 +6,100 @@
 namespace ControlServer
 {
 
-ServerSession* SessionContext::activeSession() const
+void PostToSession(
+    asio::io_service* sessionIoService,
+    const std::weak_ptr<ServerSession>& sessionRef,
+    const std::function<void (ServerSession&)>& action)
 {
-    return _activeSession;
+    sessionIoService->post(
+        [sessionRef, action] () {
+            if(std::shared_ptr<ServerSession> session = sessionRef.lock())
+                action(*session);
+        }
+    );
 }
 
-void SessionContext::authenticated(DeviceId id, ServerSession* session)
+
+SessionContext::SessionContext() :
+    _activeSession(nullptr), _activeSessionIoService(nullptr),
+    _hasRtt(false), _rtt(0), _rttJitter(0)
 {
-    Log()->info("Device \"{}\" connected", id);
+}
+
+bool SessionContext::isActiveSession(const ServerSession* session) const
+{
+    return session && session == _activeSession;
+}
+
+bool SessionContext::hasActiveSession() const
+{
+    return _activeSession != nullptr;
+}
+
+bool SessionContext::authenticated(
+    DeviceId id,
+    const ServerSession* session,
+    const std::weak_ptr<ServerSession>& sessionRef,
+    asio::io_service* sessionIoService)
+{
+    // expired session could be not reported as destroyed yet
+    if(_activeSession && !_activeSessionRef.expired())
+        return false;
 
-    assert(!_activeSession);
+    Log()->info("Device \"{}\" connected", id);
 
     _activeSession = session;
+    _activeSessionRef = sessionRef;
+    _activeSessionIoService = sessionIoService;
+    _hasRtt = false;
+
+    // new session restores streams itself after ClientReady,
+    // so retries scheduled for previous one are not actual anymore
+    for(auto& pair: _activeSources)
+        pair.second.pendingRetryId = 0;
+
+    return true;
 }
 
-void SessionContext::destroyed(DeviceId id)
+void SessionContext::destroyed(DeviceId id, const ServerSession* session)
 {
-    assert(_activeSession);
+    if(!isActiveSession(session))
+        return;
 
     _activeSession = nullptr;
+    _activeSessionRef.reset();
+    _activeSessionIoService = nullptr;
+    _hasRtt = false;
 
     Log()->info(
         "Device \"{}\" disconnected. Active sources count: {}",
         id, _activeSources.size());
 }
 
+bool SessionContext::postToActiveSession(
+    const std::function<void (ServerSession&)>& action) const
+{
+    if(!_activeSession)
+        return false;
+
+    PostToSession(_activeSessionIoService, _activeSessionRef, action);
+
+    return true;
+}
+
 void SessionContext::streamRequested(const SourceId& sourceId, const StreamDst& dst)
 {
     Log()->trace(">> SessionContext::streamRequested, sourceId: {}, destination: {}", sourceId, dst);
 
     auto it = _activeSources.find(sourceId);
     if(_activeSources.end() == it) {
-        _activeSources.insert({sourceId, dst});
+        _activeSources.insert({sourceId, ActiveSource { dst, SourceStats(), 0 }});
     } else {
         assert(false);
         Log()->error(
             "Requested streaming of already active source,"
             "sourceid: {}, active destination: {}, new destination {}",
-            sourceId, it->second, dst);
+            sourceId, it->second.dst, dst);
     }
 }
 
@@ -61,7 +117,7 @@ bool SessionContext::shouldStream(const SourceId& sourceId, StreamDst* dst /*= n
         return false;
     } else {
         if(dst)
-            *dst = it->second;
+            *dst = it->second.dst;
         return true;
     }
 }
@@ -70,11 +126,92 @@ void SessionContext::enumActiveStreams(
     const std::function<bool (const SourceId& sourceId, const StreamDst& dst)>& cb)
 {
     for(auto& pair: _activeSources) {
-        if(!cb(pair.first, pair.second))
+        if(!cb(pair.first, pair.second.dst))
             break;
     }
 }
 
+void SessionContext::streamStarted(const SourceId& sourceId)
+{
+    auto it = _activeSources.find(sourceId);
+    if(_activeSources.end() == it)
+        return;
+
+    it->second.stats.failures = 0;
+    it->second.pendingRetryId = 0;
+}
+
+bool SessionContext::streamFailed(
+    const SourceId& sourceId,
+    unsigned long long retryId,
+    unsigned* failures)
+{
+    auto it = _activeSources.find(sourceId);
+    if(_activeSources.end() == it)
+        return false;
+
+    ++it->second.stats.failures;
+    it->second.pendingRetryId = retryId;
+
+    if(failures)
+        *failures = it->second.stats.failures;
+
+    return true;
+}
+
+bool SessionContext::retryDue(
+    const SourceId& sourceId,
+    unsigned long long retryId,
+    StreamDst* dst)
+{
+    auto it = _activeSources.find(sourceId);
+    if(_activeSources.end() == it || it->second.pendingRetryId != retryId)
+        return false;
+
+    it->second.pendingRetryId = 0;
+    ++it->second.stats.retries;
+
+    if(dst)
+        *dst = it->second.dst;
+
+    return true;
+}
+
+bool SessionContext::sourceStats(const SourceId& sourceId, SourceStats* stats) const
+{
+    auto it = _activeSources.find(sourceId);
+    if(_activeSources.end() == it)
+        return false;
+
+    if(stats)
+        *stats = it->second.stats;
+
+    return true;
+}
+
+void SessionContext::heartbeat(const ServerSession* session, double rtt, double rttJitter)
+{
+    if(!isActiveSession(session))
+        return;
+
+    _hasRtt = true;
+    _rtt = rtt;
+    _rttJitter = rttJitter;
+}
+
+bool SessionContext::heartbeatStats(double* rtt, double* rttJitter) const
+{
+    if(!_hasRtt)
+        return false;
+
+    if(rtt)
+        *rtt = _rtt;
+    if(rttJitter)
+        *rttJitter = _rttJitter;
+
+    return true;
+}
+
 
 SessionContext* Sessions::find(DeviceId id)
 {
@@ -90,4 +227,13 @@ SessionContext& Sessions::get(DeviceId id)
     return _activeSessions[id];
 }
 
+void Sessions::enumConnected(
+    const std::function<void (const DeviceId&, SessionContext&)>& callback)
+{
+    for(auto& pair: _activeSessions) {
+        if(pair.second.hasActiveSession())
+            callback(pair.first, pair.second);
+    }
+}
+
 }
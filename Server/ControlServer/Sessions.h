@@ -3,6 +3,9 @@
 #include <functional>
 #include <unordered_map>
 #include <map>
+#include <memory>
+
+#include <asio.hpp>
 
 #include <Common/CommonTypes.h>
 
@@ -12,14 +15,38 @@ namespace ControlServer
 
 class ServerSession;
 
+// runs action on session's io_service if session is still alive
+void PostToSession(
+    asio::io_service* sessionIoService,
+    const std::weak_ptr<ServerSession>&,
+    const std::function<void (ServerSession&)>& action);
+
 
+// should be accessed only from thread of shard owning it
 class SessionContext
 {
 public:
-    ServerSession* activeSession() const;
+    struct SourceStats
+    {
+        unsigned failures; // since last successful start
+        unsigned long long retries; // total
+    };
+
+    SessionContext();
+
+    bool isActiveSession(const ServerSession*) const;
+    bool hasActiveSession() const;
 
-    void authenticated(DeviceId, ServerSession*);
-    void destroyed(DeviceId);
+    // returns false if device has other active session
+    bool authenticated(
+        DeviceId,
+        const ServerSession*,
+        const std::weak_ptr<ServerSession>&,
+        asio::io_service* sessionIoService);
+    void destroyed(DeviceId, const ServerSession*);
+
+    // returns false if device has no active session
+    bool postToActiveSession(const std::function<void (ServerSession&)>& action) const;
 
     void streamRequested(const SourceId& sourceId, const StreamDst&);
     void stopStreamRequested(const SourceId& sourceId);
@@ -28,9 +55,40 @@ public:
     void enumActiveStreams(
         const std::function<bool (const SourceId& sourceId, const StreamDst& dst)>&);
 
+    void streamStarted(const SourceId&);
+    // returns false if source shouldn't stream anymore,
+    // retryId identifies the only retry which is still actual
+    bool streamFailed(const SourceId&, unsigned long long retryId, unsigned* failures);
+    bool retryDue(const SourceId&, unsigned long long retryId, StreamDst*);
+
+    bool sourceStats(const SourceId&, SourceStats*) const;
+
+    // smoothed heartbeat round trip time of active session and it's mean deviation,
+    // in milliseconds
+    void heartbeat(const ServerSession*, double rtt, double rttJitter);
+    // returns false if active session has no rtt samples yet
+    bool heartbeatStats(double* rtt, double* rttJitter) const;
+
 private:
-    ServerSession* _activeSession;
-    std::map<SourceId, StreamDst> _activeSources;
+    // session can live on other shard,
+    // so it's referenced weakly and accessed only via it's io_service
+    const ServerSession* _activeSession;
+    std::weak_ptr<ServerSession> _activeSessionRef;
+    asio::io_service* _activeSessionIoService;
+
+    bool _hasRtt;
+    double _rtt;
+    double _rttJitter;
+
+    struct ActiveSource
+    {
+        StreamDst dst;
+
+        SourceStats stats;
+        unsigned long long pendingRetryId;
+    };
+
+    std::map<SourceId, ActiveSource> _activeSources;
 };
 
 
@@ -40,6 +98,8 @@ public:
     SessionContext* find(DeviceId);
     SessionContext& get(DeviceId);
 
+    void enumConnected(const std::function<void (const DeviceId&, SessionContext&)>&);
+
 private:
     std::unordered_map<DeviceId, SessionContext> _activeSessions;
 };
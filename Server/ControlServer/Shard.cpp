@@ -0,0 +1,502 @@
+#include "Shard.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "ServerSession.h"
+
+
+namespace ControlServer
+{
+
+const std::shared_ptr<spdlog::logger>& Shard::Log()
+{
+    return ControlServer::Log();
+}
+
+Shard::Shard(Server* server, const ::Server::Config::Config* config) :
+    _server(server),
+    _config(config->clone()),
+    _secureContext(_config.get()),
+    _updateCertificateTimer(_ioService),
+    _clientConfigCache(_config.get()),
+    _checkConfigTimer(_ioService),
+    _configUpdatesTimer(_ioService),
+    _statsTimer(_ioService),
+    _timerWheel(&_ioService),
+    _random(std::random_device()()),
+    _lastRetryId(0),
+    _snapshots(SNAPSHOTS_CACHE_SIZE, std::chrono::seconds(SNAPSHOT_TTL)),
+    _failedSnapshots(SNAPSHOTS_CACHE_SIZE, std::chrono::seconds(SNAPSHOT_FAILURE_TTL)),
+    _lastSnapshotRequestId(0)
+{
+}
+
+Shard::~Shard()
+{
+    stop();
+}
+
+asio::io_service* Shard::ioService()
+{
+    return &_ioService;
+}
+
+const ::Server::Config::Config* Shard::config() const
+{
+    return _config.get();
+}
+
+Sessions* Shard::sessions()
+{
+    return &_sessions;
+}
+
+ClientConfigCache* Shard::clientConfigCache()
+{
+    return &_clientConfigCache;
+}
+
+void Shard::streamStatus(
+    const DeviceId& deviceId,
+    const SourceId& sourceId,
+    bool success)
+{
+    SessionContext& sessionContext = _sessions.get(deviceId);
+
+    if(success) {
+        sessionContext.streamStarted(sourceId);
+        return;
+    }
+
+    const unsigned long long retryId = ++_lastRetryId;
+
+    unsigned failures = 0;
+    if(!sessionContext.streamFailed(sourceId, retryId, &failures))
+        return;
+
+    const std::chrono::milliseconds delay = streamRetryDelay(failures);
+
+    Log()->debug(
+        "Schedule {} streaming retry within {} ms. Device: {}, failures: {}",
+        sourceId, delay.count(), deviceId, failures);
+
+    _timerWheel.schedule(delay,
+        [this, deviceId, sourceId, retryId] () {
+            retryStream(deviceId, sourceId, retryId);
+        }
+    );
+}
+
+void Shard::scheduleStats()
+{
+    _statsTimer.expires_from_now(std::chrono::seconds(STATS_INTERVAL));
+    _statsTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            logStats();
+
+            scheduleStats();
+        }
+    );
+}
+
+void Shard::logStats()
+{
+    unsigned devices = 0;
+    unsigned streams = 0;
+    unsigned failingStreams = 0;
+    unsigned long long retries = 0;
+    unsigned rttSamples = 0;
+    double rttSum = 0;
+    double rttMax = 0;
+    double rttJitterSum = 0;
+
+    _sessions.enumConnected(
+        [&] (const DeviceId&, SessionContext& sessionContext) {
+            ++devices;
+
+            double rtt, rttJitter;
+            if(sessionContext.heartbeatStats(&rtt, &rttJitter)) {
+                ++rttSamples;
+                rttSum += rtt;
+                rttMax = std::max(rttMax, rtt);
+                rttJitterSum += rttJitter;
+            }
+
+            sessionContext.enumActiveStreams(
+                [&] (const SourceId& sourceId, const StreamDst&) -> bool {
+                    SessionContext::SourceStats stats;
+                    if(!sessionContext.sourceStats(sourceId, &stats))
+                        return true;
+
+                    ++streams;
+                    if(stats.failures)
+                        ++failingStreams;
+                    retries += stats.retries;
+
+                    return true;
+                }
+            );
+        }
+    );
+
+    Log()->info(
+        "Shard stats. Devices: {}, streams: {}, failing streams: {}, stream retries: {}, "
+        "rtt avg: {:.1f} ms, rtt max: {:.1f} ms, jitter avg: {:.1f} ms",
+        devices, streams, failingStreams, retries,
+        rttSamples ? rttSum / rttSamples : 0., rttMax,
+        rttSamples ? rttJitterSum / rttSamples : 0.);
+}
+
+// exponential backoff with "equal jitter"
+std::chrono::milliseconds Shard::streamRetryDelay(unsigned failures)
+{
+    const unsigned maxShift = 16;
+    const unsigned shift = std::min(failures > 0 ? failures - 1 : 0, maxShift);
+
+    const unsigned long long maxDelay = STREAM_RETRY_MAX_DELAY * 1000ull;
+    const unsigned long long delay =
+        std::min(maxDelay, (STREAM_RETRY_MIN_DELAY * 1000ull) << shift);
+
+    std::uniform_int_distribution<unsigned long long> distribution(0, delay / 2);
+
+    return std::chrono::milliseconds(delay - delay / 2 + distribution(_random));
+}
+
+void Shard::retryStream(
+    const DeviceId& deviceId,
+    const SourceId& sourceId,
+    unsigned long long retryId)
+{
+    SessionContext* sessionContext = _sessions.find(deviceId);
+    if(!sessionContext)
+        return;
+
+    StreamDst dst;
+    if(!sessionContext->retryDue(sourceId, retryId, &dst))
+        return;
+
+    SessionContext::SourceStats stats;
+    sessionContext->sourceStats(sourceId, &stats);
+
+    Log()->debug(
+        "Retrying {} streaming. Device: {}, retries: {}",
+        sourceId, deviceId, stats.retries);
+
+    sessionContext->postToActiveSession(
+        [sourceId, dst] (ServerSession& session) {
+            session.requestStream(sourceId, dst);
+        }
+    );
+}
+
+std::string Shard::SnapshotKey(const DeviceId& deviceId, const SourceId& sourceId)
+{
+    std::string key;
+    key.reserve(deviceId.size() + 1 + sourceId.size());
+    key += deviceId;
+    key += '\0';
+    key += sourceId;
+
+    return key;
+}
+
+void Shard::requestSnapshot(
+    const DeviceId& deviceId,
+    const SourceId& sourceId,
+    const SnapshotCallback& callback)
+{
+    const std::string key = SnapshotKey(deviceId, sourceId);
+
+    if(const std::string* jpeg = _snapshots.find(key)) {
+        callback(true, *jpeg);
+        return;
+    }
+
+    if(_failedSnapshots.find(key)) {
+        callback(false, std::string());
+        return;
+    }
+
+    auto it = _pendingSnapshots.find(key);
+    if(_pendingSnapshots.end() != it) {
+        it->second.callbacks.push_back(callback);
+        return;
+    }
+
+    SessionContext* sessionContext = _sessions.find(deviceId);
+    const bool connected =
+        sessionContext &&
+        sessionContext->postToActiveSession(
+            [sourceId] (ServerSession& session) {
+                session.requestSnapshot(sourceId);
+            }
+        );
+    if(!connected) {
+        Log()->debug(
+            "Requested snapshot for not connected device {}, sourceId: {}",
+            deviceId, sourceId);
+        callback(false, std::string());
+        return;
+    }
+
+    const unsigned long long requestId = ++_lastSnapshotRequestId;
+    _pendingSnapshots.emplace(key, PendingSnapshot { requestId, { callback } });
+
+    _timerWheel.schedule(std::chrono::seconds(SNAPSHOT_TIMEOUT),
+        [this, key, requestId] () {
+            snapshotTimeout(key, requestId);
+        }
+    );
+}
+
+void Shard::snapshotCaptured(
+    const DeviceId& deviceId,
+    const SourceId& sourceId,
+    bool success,
+    const std::string& jpeg)
+{
+    const std::string key = SnapshotKey(deviceId, sourceId);
+
+    if(success) {
+        _snapshots.put(key, jpeg);
+    } else {
+        Log()->debug("Snapshot capture failed. Device: {}, sourceId: {}", deviceId, sourceId);
+        _failedSnapshots.put(key, true);
+    }
+
+    finishSnapshot(key, success, jpeg);
+}
+
+void Shard::snapshotTimeout(const std::string& key, unsigned long long requestId)
+{
+    auto it = _pendingSnapshots.find(key);
+    if(_pendingSnapshots.end() == it || it->second.requestId != requestId)
+        return;
+
+    Log()->debug("Snapshot request timeout");
+
+    _failedSnapshots.put(key, true);
+
+    finishSnapshot(key, false, std::string());
+}
+
+void Shard::finishSnapshot(const std::string& key, bool success, const std::string& jpeg)
+{
+    auto it = _pendingSnapshots.find(key);
+    if(_pendingSnapshots.end() == it)
+        return;
+
+    std::vector<SnapshotCallback> callbacks;
+    callbacks.swap(it->second.callbacks);
+    _pendingSnapshots.erase(it);
+
+    for(const SnapshotCallback& callback: callbacks)
+        callback(success, jpeg);
+}
+
+void Shard::run()
+{
+    if(_thread.joinable())
+        return;
+
+    _working.reset(new asio::io_service::work(_ioService));
+
+    scheduleUpdateCertificate();
+    scheduleCheckConfig();
+    scheduleStats();
+
+    _thread = std::thread(&Shard::threadMain, this);
+}
+
+void Shard::stop()
+{
+    if(!_thread.joinable())
+        return;
+
+    _working.reset();
+    _ioService.stop();
+
+    _thread.join();
+}
+
+void Shard::threadMain()
+{
+    _ioService.run();
+}
+
+void Shard::scheduleUpdateCertificate()
+{
+    _updateCertificateTimer.expires_from_now(std::chrono::minutes(UPDATE_CERTIFICATE_TIMEOUT));
+    _updateCertificateTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            _secureContext.updateCertificate();
+
+            scheduleUpdateCertificate();
+        }
+    );
+}
+
+void Shard::scheduleCheckConfig()
+{
+    _checkConfigTimer.expires_from_now(std::chrono::seconds(CONFIG_CHECK_INTERVAL));
+    _checkConfigTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            checkConfig();
+
+            scheduleCheckConfig();
+        }
+    );
+}
+
+void Shard::checkConfig()
+{
+    if(!_config->checkForUpdates())
+        return;
+
+    // newer config supersedes not yet sent updates
+    _pendingConfigUpdates.clear();
+
+    _sessions.enumConnected(
+        [this] (const DeviceId& deviceId, SessionContext&) {
+            _pendingConfigUpdates.push_back(deviceId);
+        }
+    );
+
+    Log()->info(
+        "Config changed. Checking {} connected devices",
+        _pendingConfigUpdates.size());
+
+    scheduleConfigUpdates();
+}
+
+void Shard::scheduleConfigUpdates()
+{
+    if(_pendingConfigUpdates.empty())
+        return;
+
+    _configUpdatesTimer.expires_from_now(
+        std::chrono::milliseconds(CONFIG_UPDATES_BATCH_INTERVAL));
+    _configUpdatesTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            sendConfigUpdates();
+
+            scheduleConfigUpdates();
+        }
+    );
+}
+
+// limited count of devices per batch
+// to not let config rollout hammer config backend and devices
+void Shard::sendConfigUpdates()
+{
+    for(unsigned i = 0; i < CONFIG_UPDATES_BATCH_SIZE && !_pendingConfigUpdates.empty(); ++i) {
+        const DeviceId deviceId = _pendingConfigUpdates.front();
+        _pendingConfigUpdates.pop_front();
+
+        SessionContext* sessionContext = _sessions.find(deviceId);
+        if(!sessionContext || !sessionContext->hasActiveSession())
+            continue;
+
+        // unchanged configs are not sent at all
+        const std::string* reply = _clientConfigCache.changedReply(deviceId);
+        if(!reply)
+            continue;
+
+        Log()->info("Pushing updated config. Device: {}", deviceId);
+
+        const std::shared_ptr<std::string> replyBody =
+            std::make_shared<std::string>(*reply);
+        sessionContext->postToActiveSession(
+            [replyBody] (ServerSession& session) {
+                session.configUpdated(replyBody.get());
+            }
+        );
+    }
+}
+
+void Shard::accept(
+    const std::shared_ptr<asio::ip::tcp::socket>& socket,
+    const AdmissionGate::Ticket& ticket,
+    unsigned retryAfter,
+    bool overloaded)
+{
+    asio::error_code error;
+
+    const asio::ip::tcp::endpoint localEndpoint = socket->local_endpoint(error);
+    if(error) {
+        Log()->error("local_endpoint failed: {}", error.message());
+        return;
+    }
+
+    // socket is bound to acceptor's io_service,
+    // so it's descriptor is moved to shard's io_service
+    const int socketFd = dup(socket->native_handle());
+    socket->close(error);
+    if(socketFd < 0) {
+        Log()->error("Failed to duplicate socket descriptor");
+        return;
+    }
+
+    const asio::ip::tcp::socket::protocol_type protocol = localEndpoint.protocol();
+    _ioService.post(
+        [this, protocol, socketFd, ticket, retryAfter, overloaded] () {
+            startSession(protocol, socketFd, ticket, retryAfter, overloaded);
+        }
+    );
+}
+
+void Shard::startSession(
+    asio::ip::tcp::socket::protocol_type protocol,
+    int socketFd,
+    const AdmissionGate::Ticket& ticket,
+    unsigned retryAfter,
+    bool overloaded)
+{
+    if(!_secureContext.valid()) {
+        Log()->critical("Can't accept incoming connectin in invalid state.");
+        close(socketFd);
+        return;
+    }
+
+    std::shared_ptr<asio::ip::tcp::socket> socket =
+        std::make_shared<asio::ip::tcp::socket>(_ioService);
+
+    asio::error_code error;
+    socket->assign(protocol, socketFd, error);
+    if(error) {
+        Log()->error("Failed to assign socket: {}", error.message());
+        close(socketFd);
+        return;
+    }
+
+    // peer could reset connection while it was waiting for admission
+    const asio::ip::tcp::endpoint remoteEndpoint = socket->remote_endpoint(error);
+    if(error) {
+        Log()->debug("Connection lost while waiting for admission: {}", error.message());
+        socket->close(error);
+        return;
+    }
+
+    std::shared_ptr<ServerSession> session =
+        std::make_shared<ServerSession>(
+            &_ioService, _config.get(), _server, ticket, retryAfter, overloaded,
+            remoteEndpoint.address(),
+            socket, static_cast<ServerSession::SecureContext*>(&_secureContext));
+    session->handshake();
+}
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <thread>
+#include <random>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <Common/LruCache.h>
+
+#include "Server.h"
+#include "Sessions.h"
+#include "ClientConfigCache.h"
+#include "TimerWheel.h"
+
+
+namespace ControlServer
+{
+
+class Server;
+
+// serves part of connections and owns part of devices contexts
+// in it's own thread
+class Shard
+{
+public:
+    enum {
+        STREAM_RETRY_MIN_DELAY = 2, // seconds
+        STREAM_RETRY_MAX_DELAY = 5 * 60, // seconds
+
+        CONFIG_UPDATES_BATCH_SIZE = 100,
+        CONFIG_UPDATES_BATCH_INTERVAL = 100, // milliseconds
+
+        SNAPSHOTS_CACHE_SIZE = 1000,
+        SNAPSHOT_TTL = 10, // seconds
+        SNAPSHOT_TIMEOUT = 15, // seconds
+        SNAPSHOT_FAILURE_TTL = 5, // seconds
+
+        STATS_INTERVAL = 60, // seconds
+    };
+
+    typedef Server::SnapshotCallback SnapshotCallback;
+
+    Shard(Server*, const ::Server::Config::Config*);
+    ~Shard();
+
+    asio::io_service* ioService();
+    const ::Server::Config::Config* config() const;
+
+    // contexts of devices owned by this shard
+    Sessions* sessions();
+    ClientConfigCache* clientConfigCache();
+
+    // should be called from shard's thread
+    void streamStatus(const DeviceId&, const SourceId&, bool success);
+    // recently captured snapshot is reused,
+    // concurrent requests for the same source share single capture,
+    // recently failed capture is not retried for a while
+    void requestSnapshot(const DeviceId&, const SourceId&, const SnapshotCallback&);
+    void snapshotCaptured(const DeviceId&, const SourceId&, bool success, const std::string& jpeg);
+
+    void run();
+    void stop();
+
+    // takes ownership of socket accepted on other io_service
+    // retryAfter - hint for device when to reconnect next time
+    // overloaded - device should be rejected right after handshake
+    void accept(
+        const std::shared_ptr<asio::ip::tcp::socket>&,
+        const AdmissionGate::Ticket&,
+        unsigned retryAfter,
+        bool overloaded);
+
+private:
+    static inline const std::shared_ptr<spdlog::logger>& Log();
+
+    void threadMain();
+
+    void scheduleUpdateCertificate();
+
+    void scheduleCheckConfig();
+    void checkConfig();
+    void scheduleConfigUpdates();
+    void sendConfigUpdates();
+
+    void scheduleStats();
+    void logStats();
+
+    std::chrono::milliseconds streamRetryDelay(unsigned failures);
+    void retryStream(const DeviceId&, const SourceId&, unsigned long long retryId);
+
+    static std::string SnapshotKey(const DeviceId&, const SourceId&);
+    void snapshotTimeout(const std::string& key, unsigned long long requestId);
+    void finishSnapshot(const std::string& key, bool success, const std::string& jpeg);
+
+    void startSession(
+        asio::ip::tcp::socket::protocol_type,
+        int socketFd,
+        const AdmissionGate::Ticket&,
+        unsigned retryAfter,
+        bool overloaded);
+
+private:
+    Server *const _server;
+
+    asio::io_service _ioService;
+    std::unique_ptr<asio::io_service::work> _working;
+
+    // config backend is not required to be thread safe
+    const std::unique_ptr<::Server::Config::Config> _config;
+
+    ServerSecureContext _secureContext;
+    asio::steady_timer _updateCertificateTimer;
+
+    Sessions _sessions;
+    ClientConfigCache _clientConfigCache;
+
+    asio::steady_timer _checkConfigTimer;
+    asio::steady_timer _configUpdatesTimer;
+    // connected devices which config could be changed
+    std::deque<DeviceId> _pendingConfigUpdates;
+
+    asio::steady_timer _statsTimer;
+
+    TimerWheel _timerWheel;
+    std::mt19937 _random;
+    unsigned long long _lastRetryId;
+
+    struct PendingSnapshot
+    {
+        unsigned long long requestId;
+        std::vector<SnapshotCallback> callbacks;
+    };
+
+    // snapshot key -> jpeg
+    LruCache<std::string, std::string> _snapshots;
+    // snapshot key -> nothing
+    LruCache<std::string, bool> _failedSnapshots;
+    std::unordered_map<std::string, PendingSnapshot> _pendingSnapshots;
+    unsigned long long _lastSnapshotRequestId;
+
+    std::thread _thread;
+};
+
+}
@@ -0,0 +1,510 @@
+#include "SnapshotServer.h"
+
+#include <cstring>
+#include <algorithm>
+#include <istream>
+
+#include <glib.h>
+
+#include <Common/Keys.h>
+#include <Common/Hash.h>
+
+#include "Server.h"
+#include "Shard.h"
+
+
+namespace ControlServer
+{
+
+///////////////////////////////////////////////////////////////////////////////
+class SnapshotServer::Session : public std::enable_shared_from_this<Session>
+{
+public:
+    Session(SnapshotServer*, asio::io_service*, asio::ssl::context*);
+
+    asio::ssl::stream<asio::ip::tcp::socket>::lowest_layer_type& socket()
+        { return _stream.lowest_layer(); }
+
+    void start();
+
+private:
+    void onHandshake(const asio::error_code&);
+    void onRequest(const asio::error_code&);
+    void handleRequest();
+    void onSnapshot(bool success, const std::string& jpeg);
+
+    void reply(
+        const std::string& status,
+        const std::string& headers = std::string(),
+        const std::string& body = std::string());
+    void onReplied(const asio::error_code&);
+
+    void close();
+
+private:
+    SnapshotServer *const _owner;
+    asio::io_service* _ioService;
+
+    asio::ssl::stream<asio::ip::tcp::socket> _stream;
+    asio::steady_timer _timeoutTimer;
+
+    asio::streambuf _request;
+    std::string _response;
+
+    // snapshot could arrive after timeout already closed connection
+    bool _closed;
+};
+
+SnapshotServer::Session::Session(
+    SnapshotServer* owner,
+    asio::io_service* ioService,
+    asio::ssl::context* context) :
+    _owner(owner),
+    _ioService(ioService),
+    _stream(*ioService, *context),
+    _timeoutTimer(*ioService),
+    _request(MAX_REQUEST_SIZE),
+    _closed(false)
+{
+}
+
+void SnapshotServer::Session::start()
+{
+    std::shared_ptr<Session> self = shared_from_this();
+
+    _timeoutTimer.expires_from_now(std::chrono::seconds(REQUEST_TIMEOUT));
+    _timeoutTimer.async_wait(
+        [self] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            Log()->debug("Snapshot request timeout");
+
+            self->close();
+        }
+    );
+
+    _stream.async_handshake(
+        asio::ssl::stream_base::server,
+        [self] (const asio::error_code& error) {
+            self->onHandshake(error);
+        }
+    );
+}
+
+void SnapshotServer::Session::onHandshake(const asio::error_code& error)
+{
+    if(error) {
+        Log()->debug("Snapshot request handshake failed: {}", error.message());
+        close();
+        return;
+    }
+
+    std::shared_ptr<Session> self = shared_from_this();
+    asio::async_read_until(_stream, _request, "\r\n\r\n",
+        [self] (const asio::error_code& error, size_t /*bytesTransferred*/) {
+            self->onRequest(error);
+        }
+    );
+}
+
+void SnapshotServer::Session::onRequest(const asio::error_code& error)
+{
+    if(error) {
+        Log()->debug("Failed to read snapshot request: {}", error.message());
+        close();
+        return;
+    }
+
+    handleRequest();
+}
+
+void SnapshotServer::Session::handleRequest()
+{
+    std::istream request(&_request);
+
+    std::string method, target, version;
+    request >> method >> target >> version;
+
+    std::string line;
+    std::getline(request, line); // rest of request line
+
+    std::string authorization;
+    while(std::getline(request, line) && line != "\r") {
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        const std::string::size_type colon = line.find(':');
+        if(std::string::npos == colon)
+            continue;
+
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if(name != "authorization")
+            continue;
+
+        const std::string::size_type valuePos = line.find_first_not_of(' ', colon + 1);
+        if(std::string::npos != valuePos)
+            authorization = line.substr(valuePos);
+    }
+
+    Log()->debug("Snapshot request: {} {}", method, target);
+
+    if(method != "GET") {
+        reply("405 Method Not Allowed", "Allow: GET\r\n");
+        return;
+    }
+
+    static const std::string prefix = "/snapshot/";
+    if(0 != target.compare(0, prefix.size(), prefix)) {
+        reply("404 Not Found");
+        return;
+    }
+
+    const SourceId sourceId = target.substr(prefix.size(), target.find('?') - prefix.size());
+    if(sourceId.empty()) {
+        reply("404 Not Found");
+        return;
+    }
+
+    UserName userName;
+    if(!_owner->authenticate(authorization, &userName)) {
+        reply("401 Unauthorized", "WWW-Authenticate: Basic realm=\"IpCamBox\"\r\n");
+        return;
+    }
+
+    ::Server::Config::PlaySource playSource;
+    if(!_owner->_config->findUserSource(userName, sourceId, &playSource)) {
+        Log()->info("Source \"{}\" not found for user \"{}\"", sourceId, userName);
+        reply("404 Not Found");
+        return;
+    }
+
+    std::shared_ptr<Session> self = shared_from_this();
+    asio::io_service* ioService = _ioService;
+    _owner->_server->requestSnapshot(
+        playSource.deviceId, playSource.sourceId,
+        [self, ioService] (bool success, const std::string& jpeg) {
+            // called from shard's thread
+            ioService->post(
+                [self, success, jpeg] () {
+                    self->onSnapshot(success, jpeg);
+                }
+            );
+        }
+    );
+}
+
+void SnapshotServer::Session::onSnapshot(bool success, const std::string& jpeg)
+{
+    if(!success) {
+        reply("503 Service Unavailable");
+        return;
+    }
+
+    reply(
+        "200 OK",
+        fmt::format(
+            "Content-Type: image/jpeg\r\n"
+            "Cache-Control: max-age={}\r\n",
+            static_cast<unsigned>(Shard::SNAPSHOT_TTL)),
+        jpeg);
+}
+
+void SnapshotServer::Session::reply(
+    const std::string& status,
+    const std::string& headers,
+    const std::string& body)
+{
+    if(_closed)
+        return;
+
+    _response =
+        fmt::format(
+            "HTTP/1.1 {}\r\n"
+            "{}"
+            "Content-Length: {}\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            status, headers, body.size());
+    _response += body;
+
+    std::shared_ptr<Session> self = shared_from_this();
+    asio::async_write(_stream, asio::buffer(_response),
+        [self] (const asio::error_code& error, size_t /*bytesTransferred*/) {
+            self->onReplied(error);
+        }
+    );
+}
+
+void SnapshotServer::Session::onReplied(const asio::error_code& error)
+{
+    if(error) {
+        Log()->debug("Failed to send snapshot reply: {}", error.message());
+        close();
+        return;
+    }
+
+    std::shared_ptr<Session> self = shared_from_this();
+    _stream.async_shutdown(
+        [self] (const asio::error_code&) {
+            self->close();
+        }
+    );
+}
+
+void SnapshotServer::Session::close()
+{
+    _closed = true;
+
+    _timeoutTimer.cancel();
+
+    asio::error_code error;
+    _stream.lowest_layer().close(error);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const std::shared_ptr<spdlog::logger>& SnapshotServer::Log()
+{
+    return ControlServer::Log();
+}
+
+SnapshotServer::SnapshotServer(
+    asio::io_service* ioService,
+    const ::Server::Config::Config* config,
+    ::Server::Config::CredentialsCache* credentialsCache,
+    Server* server) :
+    _ioService(ioService),
+    _config(config->clone()),
+    _credentialsCache(credentialsCache),
+    _server(server),
+    _context(asio::ssl::context::sslv23),
+    _valid(false),
+    _updateCertificateTimer(*ioService),
+    _checkConfigTimer(*ioService),
+    _acceptor(*ioService)
+{
+    _valid = setupContext();
+}
+
+SnapshotServer::~SnapshotServer()
+{
+    asio::error_code error;
+    _acceptor.close(error);
+}
+
+bool SnapshotServer::setupContext()
+{
+    using namespace asio;
+
+    error_code error;
+
+    _context.set_options(
+        ssl::context::default_workarounds |
+        ssl::context::no_sslv2 |
+        ssl::context::no_sslv3 |
+        ssl::context::single_dh_use,
+        error);
+    if(error) {
+        Log()->critical("set_options failed: {}", error.message());
+        return false;
+    }
+
+    _context.use_tmp_dh(const_buffer(TmpDH2048, strlen(TmpDH2048)), error);
+    if(error) {
+        Log()->critical("use_tmp_dh failed: {}", error.message());
+        return false;
+    }
+
+    SSL_CTX* ctx = _context.native_handle();
+
+    if(!SSL_CTX_set_cipher_list(ctx, TLS_CIPHERS)) {
+        Log()->critical("SSL_CTX_set_cipher_list failed");
+        return false;
+    }
+
+    if(!SSL_CTX_set1_curves_list(ctx, TLS_CURVES)) {
+        Log()->critical("SSL_CTX_set1_curves_list failed");
+        return false;
+    }
+
+    SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    return updateCertificate();
+}
+
+bool SnapshotServer::updateCertificate()
+{
+    Log()->trace(">> SnapshotServer::updateCertificate");
+
+    using namespace asio;
+
+    const std::string certificate = _config->certificate();
+
+    error_code error;
+
+    _context.use_private_key(
+        const_buffer(certificate.data(), certificate.size()),
+        ssl::context::pem,
+        error);
+    if(error) {
+        Log()->critical("use_private_key failed: {}", error.message());
+        return false;
+    }
+
+    _context.use_certificate_chain(
+        const_buffer(certificate.data(), certificate.size()),
+        error);
+    if(error) {
+        Log()->critical("use_certificate_chain failed: {}", error.message());
+        return false;
+    }
+
+    return true;
+}
+
+void SnapshotServer::scheduleUpdateCertificate()
+{
+    _updateCertificateTimer.expires_from_now(std::chrono::minutes(UPDATE_CERTIFICATE_TIMEOUT));
+    _updateCertificateTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            updateCertificate();
+
+            scheduleUpdateCertificate();
+        }
+    );
+}
+
+void SnapshotServer::scheduleCheckConfig()
+{
+    _checkConfigTimer.expires_from_now(std::chrono::seconds(CONFIG_CHECK_INTERVAL));
+    _checkConfigTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            if(_config->checkForUpdates())
+                _credentialsCache->invalidate();
+
+            scheduleCheckConfig();
+        }
+    );
+}
+
+void SnapshotServer::startAccept()
+{
+    if(!_valid) {
+        Log()->critical("Snapshot server is not started in invalid state");
+        return;
+    }
+
+    using namespace asio::ip;
+
+    const Port port = _config->serverConfig()->snapshotServerPort;
+
+    asio::error_code error;
+    _acceptor.open(tcp::v4(), error);
+    if(!error)
+        _acceptor.set_option(tcp::acceptor::reuse_address(true), error);
+    if(!error)
+        _acceptor.bind(tcp::endpoint(tcp::v4(), port), error);
+    if(!error)
+        _acceptor.listen(asio::socket_base::max_connections, error);
+    if(error) {
+        Log()->critical("Fail to listen snapshot server port {}: {}", port, error.message());
+        return;
+    }
+
+    Log()->info("Snapshot server listening on port {}", port);
+
+    scheduleUpdateCertificate();
+    scheduleCheckConfig();
+
+    accept();
+}
+
+void SnapshotServer::accept()
+{
+    std::shared_ptr<Session> session =
+        std::make_shared<Session>(this, _ioService, &_context);
+
+    _acceptor.async_accept(session->socket(),
+        [this, session] (const asio::error_code& error) {
+            if(error == asio::error::operation_aborted)
+                return;
+
+            if(error)
+                Log()->error("Snapshot server accept failed: {}", error.message());
+            else
+                session->start();
+
+            accept();
+        }
+    );
+}
+
+bool SnapshotServer::authenticate(
+    const std::string& authorization,
+    UserName* userName)
+{
+    UserName name;
+    std::string pass;
+
+    static const std::string basic = "Basic ";
+    if(!authorization.empty()) {
+        if(0 != authorization.compare(0, basic.size(), basic))
+            return false;
+
+        gsize credentialsSize = 0;
+        guchar* credentialsData =
+            g_base64_decode(authorization.c_str() + basic.size(), &credentialsSize);
+        const std::string credentials(
+            reinterpret_cast<const char*>(credentialsData), credentialsSize);
+        g_free(credentialsData);
+
+        const std::string::size_type colon = credentials.find(':');
+        if(std::string::npos == colon)
+            return false;
+
+        name = credentials.substr(0, colon);
+        pass = credentials.substr(colon + 1);
+    }
+
+    if(_credentialsCache->find(name, pass)) {
+        *userName = name;
+        return true;
+    }
+
+    // taken before config lookup,
+    // so credentials checked with outdated config are not cached
+    const unsigned credentialsGeneration = _credentialsCache->generation();
+
+    ::Server::Config::User user;
+    if(!_config->findUser(name, &user)) {
+        Log()->info("User \"{}\" not found", name);
+        return false;
+    }
+
+    if(!user.name.empty()) {
+        if(user.playPasswordSalt.empty() || user.playPasswordHash.empty()) {
+            Log()->error("User \"{}\" has empty salt or hash", name);
+            return false;
+        }
+
+        if(!CheckHash(user.playPasswordHashType, pass, user.playPasswordSalt, user.playPasswordHash)) {
+            Log()->error("Password hash check failed for user \"{}\"", name);
+            return false;
+        }
+
+        _credentialsCache->put(credentialsGeneration, name, pass);
+    }
+
+    *userName = name;
+
+    return true;
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <memory>
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <Common/CommonTypes.h>
+
+#include "Log.h"
+#include "Config/Config.h"
+#include "Config/CredentialsCache.h"
+
+
+namespace ControlServer
+{
+
+class Server;
+
+// serves JPEG snapshots of sources over HTTPS:
+// "GET /snapshot/<sourceId>" with the same credentials as used for playback
+// (HTTP Basic authentication, anonymous user if credentials are missing)
+class SnapshotServer
+{
+public:
+    enum {
+        REQUEST_TIMEOUT = 30, // seconds
+        MAX_REQUEST_SIZE = 8 * 1024, // bytes
+    };
+
+    // credentials cache is shared with restream server
+    SnapshotServer(
+        asio::io_service*,
+        const ::Server::Config::Config*,
+        ::Server::Config::CredentialsCache*,
+        Server*);
+    ~SnapshotServer();
+
+    void startAccept();
+
+private:
+    class Session;
+
+    static inline const std::shared_ptr<spdlog::logger>& Log();
+
+    bool setupContext();
+    bool updateCertificate();
+    void scheduleUpdateCertificate();
+
+    void scheduleCheckConfig();
+
+    void accept();
+
+    // authorization - value of "Authorization" header,
+    // empty for anonymous user
+    bool authenticate(const std::string& authorization, UserName*);
+
+private:
+    asio::io_service* _ioService;
+
+    // config backend is not required to be thread safe
+    const std::unique_ptr<::Server::Config::Config> _config;
+    ::Server::Config::CredentialsCache *const _credentialsCache;
+
+    Server *const _server;
+
+    asio::ssl::context _context;
+    bool _valid;
+    asio::steady_timer _updateCertificateTimer;
+
+    asio::steady_timer _checkConfigTimer;
+
+    asio::ip::tcp::acceptor _acceptor;
+};
+
+}
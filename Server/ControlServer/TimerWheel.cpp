@@ -0,0 +1,106 @@
+#include "TimerWheel.h"
+
+
+namespace ControlServer
+{
+
+TimerWheel::TimerWheel(asio::io_service* ioService) :
+    _tickTimer(*ioService), _ticking(false),
+    _currentTick(0), _size(0)
+{
+}
+
+size_t TimerWheel::size() const
+{
+    return _size;
+}
+
+void TimerWheel::schedule(std::chrono::milliseconds delay, const Callback& callback)
+{
+    uint64_t ticks = (delay.count() + TICK - 1) / TICK;
+    if(ticks < 1)
+        ticks = 1;
+
+    const uint64_t maxTicks = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    if(ticks > maxTicks)
+        ticks = maxTicks;
+
+    insert(Entry { _currentTick + ticks, callback });
+    ++_size;
+
+    if(!_ticking) {
+        _ticking = true;
+        _tickTimer.expires_from_now(std::chrono::milliseconds(TICK));
+        scheduleTick();
+    }
+}
+
+void TimerWheel::insert(Entry&& entry)
+{
+    const uint64_t delta = entry.expiresAt - _currentTick;
+
+    unsigned level = 0;
+    while(level + 1 < LEVELS && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+        ++level;
+
+    const unsigned slot = (entry.expiresAt >> (SLOT_BITS * level)) & (SLOTS - 1);
+    _slots[level][slot].push_back(std::move(entry));
+}
+
+void TimerWheel::cascade(unsigned level)
+{
+    const unsigned slot = (_currentTick >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+    std::vector<Entry> entries;
+    entries.swap(_slots[level][slot]);
+
+    for(Entry& entry: entries)
+        insert(std::move(entry));
+}
+
+void TimerWheel::advance()
+{
+    ++_currentTick;
+
+    // move timers from upper levels when lower level wheel wraps around
+    unsigned wrappedLevels = 0;
+    while(wrappedLevels + 1 < LEVELS &&
+          0 == ((_currentTick >> (SLOT_BITS * wrappedLevels)) & (SLOTS - 1)))
+    {
+        ++wrappedLevels;
+    }
+    for(unsigned level = wrappedLevels; level > 0; --level)
+        cascade(level);
+
+    std::vector<Entry> expired;
+    expired.swap(_slots[0][_currentTick & (SLOTS - 1)]);
+
+    _size -= expired.size();
+
+    for(Entry& entry: expired)
+        entry.callback();
+}
+
+void TimerWheel::scheduleTick()
+{
+    _tickTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            advance();
+
+            if(!_size) {
+                _ticking = false;
+                return;
+            }
+
+            // keep ticks evenly spaced regardless of callbacks duration
+            _tickTimer.expires_at(
+                _tickTimer.expires_at() + std::chrono::milliseconds(TICK));
+            scheduleTick();
+        }
+    );
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+#include <asio.hpp>
+
+
+namespace ControlServer
+{
+
+// hierarchical timing wheel:
+// scheduling and expiration cost O(1) per timer regardless of timers count.
+// there is no cancellation, callbacks should check if they are still actual.
+class TimerWheel
+{
+public:
+    enum {
+        TICK = 100, // milliseconds
+        SLOT_BITS = 8,
+        SLOTS = 1 << SLOT_BITS,
+        LEVELS = 3, // covers 2^24 ticks, ~19 days
+    };
+
+    typedef std::function<void ()> Callback;
+
+    TimerWheel(asio::io_service*);
+
+    void schedule(std::chrono::milliseconds delay, const Callback&);
+
+    size_t size() const;
+
+    // moves wheel one TICK forward and runs expired callbacks,
+    // called by internal timer, public to let tests drive the wheel
+    void advance();
+
+private:
+    struct Entry
+    {
+        uint64_t expiresAt; // in ticks
+        Callback callback;
+    };
+
+    void insert(Entry&&);
+    void cascade(unsigned level);
+
+    void scheduleTick();
+
+private:
+    asio::steady_timer _tickTimer;
+    bool _ticking;
+
+    uint64_t _currentTick;
+    size_t _size;
+
+    std::vector<Entry> _slots[LEVELS][SLOTS];
+};
+
+}
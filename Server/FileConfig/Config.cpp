@@ -1,13 +1,12 @@
 #include "Config.h"
 
-#include <openssl/pem.h>
 #include <libconfig.h>
 
+#include <glib/gstdio.h>
+
 #undef CHAR_WIDTH
 #include <spdlog/fmt/fmt.h>
 
-#include <CxxPtr/GlibPtr.h>
-
 #include "../Config/Log.h"
 
 
@@ -19,7 +18,7 @@ namespace FileConfig
 
 Source* Device::addSource(const SourceId& sourceId)
 {
-    return &sources.emplace(sourceId, Source{.id = sourceId}).first->second;
+    return &sources.emplace(sourceId, Source{.id = sourceId, .linger = DEFAULT_STREAM_LINGER}).first->second;
 }
 
 const Source* Device::findSource(const SourceId& sourceId) const
@@ -62,8 +61,12 @@ const PlaySource* User::findSource(const SourceId& sourceId) const
 }
 
 
-Config::Config()
+Config::Config() :
+    _loaded(false), _configModified(0), _generation(0)
 {
+    // before load, to not miss changes made during it
+    _configModified = configModified();
+
     loadConfig();
     loadCertificates();
 }
@@ -79,6 +82,28 @@ std::string Config::configDir() const
     return configDir;
 }
 
+std::string Config::configFile() const
+{
+    const std::string configDir = this->configDir();
+    if(configDir.empty())
+        return std::string();
+
+    return fmt::format("{}/{}", configDir, "ipcambox.config");
+}
+
+time_t Config::configModified() const
+{
+    const std::string configFile = this->configFile();
+    if(configFile.empty())
+        return 0;
+
+    GStatBuf stat;
+    if(g_stat(configFile.c_str(), &stat) != 0)
+        return 0;
+
+    return stat.st_mtime;
+}
+
 struct LibconfigDestroy
 {
     void operator() (config_t* object)
@@ -105,6 +130,10 @@ void Config::loadDeviceSourceConfig(Device* device, config_setting_t* sourceConf
 
     Source* source = device->addSource(id);
     source->uri = uri;
+
+    int linger;
+    if(CONFIG_TRUE == config_setting_lookup_int(sourceConfig, "linger", &linger) && linger >= 0)
+        source->linger = linger;
 }
 
 void Config::loadDeviceConfig(config_setting_t* deviceConfig)
@@ -199,17 +228,14 @@ void Config::loadUserConfig(config_setting_t* userConfig)
 
 void Config::loadConfig()
 {
-    const std::string configDir = this->configDir();
-    if(configDir.empty())
+    const std::string configFile = this->configFile();
+    if(configFile.empty())
         return;
 
     config_t config;
     config_init(&config);
     ConfigDestroy ConfigDestroy(&config);
 
-    const std::string configFile =
-        fmt::format("{}/{}", configDir, "ipcambox.config").c_str();
-
     if(!config_read_file(&config, configFile.c_str())) {
         ConfigLog()->critical("Fail load config {}", configFile);
         return;
@@ -218,6 +244,7 @@ void Config::loadConfig()
     _serverConfig.controlServerPort = DEFAULT_CONTROL_SERVER_PORT;
     _serverConfig.staticServerPort = DEFAULT_STATIC_SERVER_PORT;
     _serverConfig.restreamServerPort = DEFAULT_RESTREAM_SERVER_PORT;
+    _serverConfig.snapshotServerPort = DEFAULT_SNAPSHOT_SERVER_PORT;
 
     config_setting_t* serverConfig = config_lookup(&config, "server");
     if(serverConfig && CONFIG_TRUE == config_setting_is_group(serverConfig)) {
@@ -233,6 +260,16 @@ void Config::loadConfig()
         if(CONFIG_TRUE == config_setting_lookup_string(serverConfig, "key", &privateKeyPath)) {
             _privateKeyPath = privateKeyPath;
         }
+        const char* noSignalSplashSource = nullptr;
+        if(CONFIG_TRUE == config_setting_lookup_string(serverConfig, "splash", &noSignalSplashSource)) {
+            _serverConfig.noSignalSplashSource = noSignalSplashSource;
+        }
+        int snapshotPort;
+        if(CONFIG_TRUE == config_setting_lookup_int(serverConfig, "snapshot_port", &snapshotPort) &&
+           snapshotPort > 0 && snapshotPort <= 0xFFFF)
+        {
+            _serverConfig.snapshotServerPort = static_cast<Port>(snapshotPort);
+        }
     }
 
     if(_serverConfig.serverHost.empty()) {
@@ -267,6 +304,8 @@ void Config::loadConfig()
             loadUserConfig(userConfig);
         }
     }
+
+    _loaded = true;
 }
 
 static std::string FullPath(const std::string& configDir, const std::string& path)
@@ -312,145 +351,60 @@ std::string Config::certificate() const
 
 void Config::loadCertificates()
 {
-    _allowedClients.reset(X509_STORE_new());
-    X509_STORE* allowedClients = _allowedClients.get();
-    if(!allowedClients) {
-        ConfigLog()->error("X509_STORE_new failed");
-        return;
-    }
+    _certificateIndex.clear();
 
     enumDevices(
         [this] (const ::Server::Config::Device& device) {
-            if(device.certificate.empty()) {
-                ConfigLog()->warn("Empty device certificate");
-                return;
-            }
-
-            BIOPtr deviceCertBioPtr(BIO_new(BIO_s_mem()));
-            BIO* deviceCertBio = deviceCertBioPtr.get();
-            if(!deviceCertBio) {
-                ConfigLog()->error("BIO_new failed");
-                return;
-            }
-
-            if(BIO_write(
-                deviceCertBio,
-                device.certificate.data(),
-                device.certificate.size()) <= 0)
-            {
-                ConfigLog()->error("BIO_write failed");
-                return;
-            }
-
-            X509Ptr deviceCertPtr(PEM_read_bio_X509(deviceCertBio, NULL, NULL, NULL));
-            X509* deviceCert = deviceCertPtr.get();
-            if(!deviceCert) {
-                ConfigLog()->error("Failed parse device box certificate");
-                return;
-            }
-
-            if(!X509_STORE_add_cert(_allowedClients.get(), deviceCert)) {
-                ConfigLog()->error("X509_STORE_add_cert failed");
-            }
+            _certificateIndex.add(device.certificate, device.id);
         }
     );
+
+    ConfigLog()->info("Loaded {} device certificates", _certificateIndex.size());
 }
 
-bool Config::authenticate(X509* cert, std::string* id) const
+bool Config::authenticate(X509* cert, UserName* name) const
 {
-    X509_STORE* allowedClients = _allowedClients.get();
-    if(!allowedClients)
-        return false;
-
-    X509_STORE_CTXPtr ctxPtr(X509_STORE_CTX_new());
-    X509_STORE_CTX* ctx = ctxPtr.get();
-    if(!ctx) {
-        ConfigLog()->error("X509_STORE_CTX_new failed");
-        return false;
-    }
-
-    if(!X509_STORE_CTX_init(ctx, allowedClients, cert, NULL))
-        return false;
-
-    if(!X509_verify_cert(ctx)) {
-        ConfigLog()->error("Client certificate is NOT allowed");
-        return false;
-    }
-
-    X509_NAME* subject = X509_get_subject_name(cert);
-    if(!subject) {
-        ConfigLog()->error("X509_get_subject_name failed");
-        return false;
-    }
-
-    const int nameIndex = X509_NAME_get_index_by_NID(subject, NID_commonName, -1);
-    if(nameIndex < 0) {
-        ConfigLog()->error("X509_NAME_get_entry failed");
-        return false;
-    }
-
-    X509_NAME_ENTRY* nameEntry = X509_NAME_get_entry(subject, nameIndex);
-    if(!nameEntry) {
-        ConfigLog()->error("X509_NAME_get_entry failed");
-        return false;
-    }
-
-    ASN1_STRING* asn1Name = X509_NAME_ENTRY_get_data(nameEntry);
-    if(!asn1Name) {
-        ConfigLog()->error("X509_NAME_ENTRY_get_data failed");
-        return false;
-    }
-
-    const unsigned char* commonName = ASN1_STRING_data(asn1Name);
-    if(!commonName) {
-        ConfigLog()->error("ASN1_STRING_get0_data failed");
-        return false;
-    }
-
-    ConfigLog()->info("Client certificate is allowed. Subject: {}", commonName);
+    return _certificateIndex.find(cert, name);
+}
 
-    if(id)
-        *id = reinterpret_cast<const std::string::value_type*>(commonName);
+bool Config::authenticate(GTlsCertificate* cert, UserName* name) const
+{
+    return _certificateIndex.find(cert, name);
+}
 
-    return true;
+std::unique_ptr<::Server::Config::Config> Config::clone() const
+{
+    return std::make_unique<Config>();
 }
 
-bool Config::authenticate(GTlsCertificate* cert, UserName* name) const
+unsigned Config::generation() const
 {
-    BIOPtr certBioPtr(BIO_new(BIO_s_mem()));
-    BIO* certBio = certBioPtr.get();
-    if(!certBio) {
-        ConfigLog()->error("BIO_new failed");
-        return false;
-    }
+    return _generation;
+}
 
-    gchar* pemCertificate;
-    g_object_get(cert, "certificate-pem", &pemCertificate, NULL);
-    if(!pemCertificate) {
-        ConfigLog()->error("certificate-pem access failed");
+bool Config::checkForUpdates()
+{
+    const time_t configModified = this->configModified();
+    if(!configModified || configModified == _configModified)
         return false;
-    }
 
-    GCharPtr pemCertificatePtr(pemCertificate);
+    _configModified = configModified;
 
-    if(BIO_puts(certBio, pemCertificate) <= 0) {
-        ConfigLog()->error("BIO_write failed");
+    Config config;
+    if(!config._loaded) {
+        ConfigLog()->error("Failed to reload config. Previous one is kept.");
         return false;
     }
 
-    X509Ptr x509CertPtr(PEM_read_bio_X509(certBio, NULL, NULL, NULL));
-    X509* x509Cert = x509CertPtr.get();
-    if(!x509Cert) {
-        ConfigLog()->error("Failed parse client certificate");
-        return false;
-    }
+    _devices.swap(config._devices);
+    _users.swap(config._users);
+    _certificateIndex = std::move(config._certificateIndex);
 
-    return authenticate(x509Cert, name);
-}
+    ++_generation;
 
-std::unique_ptr<const ::Server::Config::Config> Config::clone() const
-{
-    return std::make_unique<Config>();
+    ConfigLog()->info("Config reloaded");
+
+    return true;
 }
 
 const Server* Config::serverConfig() const
@@ -1,8 +1,7 @@
 #pragma once
 
-#include <CxxPtr/OpenSSLPtr.h>
-
 #include "../Config/Config.h"
+#include "../Config/CertificateIndex.h"
 
 struct config_setting_t;
 
@@ -64,7 +63,12 @@ public:
     const ::Server::Config::Server* serverConfig() const override;
 
 
-    std::unique_ptr<const ::Server::Config::Config> clone() const override;
+    std::unique_ptr<::Server::Config::Config> clone() const override;
+
+    unsigned generation() const override;
+    // reloads devices and users if config file was modified,
+    // server settings are applied only on restart
+    bool checkForUpdates() override;
 
 
     std::string certificate() const override;
@@ -91,6 +95,8 @@ private:
     User* addUser(const UserName&);
 
     std::string configDir() const;
+    std::string configFile() const;
+    time_t configModified() const;
 
     void loadConfig();
     void loadDeviceConfig(config_setting_t*);
@@ -106,10 +112,14 @@ private:
     std::string _privateKeyPath;
     mutable std::string _certificate;
 
+    bool _loaded;
+    time_t _configModified;
+    unsigned _generation;
+
     std::unordered_map<DeviceId, Device> _devices;
     std::unordered_map<UserName, User> _users;
 
-    X509_STOREPtr _allowedClients;
+    ::Server::Config::CertificateIndex _certificateIndex;
 };
 
 }
@@ -2,13 +2,8 @@
 
 #include <arpa/inet.h>
 
-#include <openssl/pem.h>
-#include <openssl/x509.h>
-
-#include <CxxPtr/GlibPtr.h>
-#include <CxxPtr/OpenSSLPtr.h>
-
 #include "../Config/Log.h"
+#include "../Config/CertificateIndex.h"
 #include "PGPtr.h"
 
 
@@ -21,11 +16,25 @@ namespace PGConfig
 struct Config::Private
 {
     PGconnPtr _connPtr;
+    bool _listening;
+
+    unsigned _generation;
 
     ::Server::Config::Server _server;
 
+    // rebuilt only on config change, to keep db access off TLS handshake
+    ::Server::Config::CertificateIndex _certificateIndex;
+    bool _certificateIndexLoaded;
+
     PGconn* checkConnected();
 
+    bool listenConfigChanged(PGconn*);
+    bool checkForUpdates();
+
+    bool loadCertificateIndex();
+    template<typename Certificate>
+    bool authenticate(Certificate*, UserName*);
+
     bool isDeviceExists(const DeviceId&);
     bool findDevice(const DeviceId&, ::Server::Config::Device* out);
 
@@ -48,6 +57,7 @@ PGconn* Config::Private::checkConnected()
     PGconn* conn = _connPtr.get();
     if(PQstatus(conn) != CONNECTION_OK) {
         PQreset(conn); // try restore connection. FIXME! maybe should use some timeout
+        _listening = false; // LISTEN is not restored with connection
     }
 
     if(PQstatus(conn) == CONNECTION_OK) {
@@ -60,6 +70,104 @@ PGconn* Config::Private::checkConnected()
     }
 }
 
+bool Config::Private::listenConfigChanged(PGconn* conn)
+{
+    if(_listening)
+        return true;
+
+    PGresultPtr resultPtr(PQexec(conn, "LISTEN config_changed"));
+    if(PQresultStatus(resultPtr.get()) != PGRES_COMMAND_OK) {
+        ConfigLog()->error(
+            "Failed to listen config changes: {}",
+            PQresultErrorMessage(resultPtr.get()));
+        return false;
+    }
+
+    _listening = true;
+
+    return true;
+}
+
+bool Config::Private::checkForUpdates()
+{
+    PGconn* conn = checkConnected();
+    if(!conn)
+        return false;
+
+    // changes made while not listening are unknown,
+    // so (re)subscription is considered as change
+    bool changed = !_listening;
+    if(!listenConfigChanged(conn))
+        return false;
+
+    if(!PQconsumeInput(conn)) {
+        ConfigLog()->error(
+            "Failed to check config changes: {}",
+            PQerrorMessage(conn));
+        return false;
+    }
+
+    while(PGnotify* notify = PQnotifies(conn)) {
+        changed = true;
+        PQfreemem(notify);
+    }
+
+    if(changed) {
+        ++_generation;
+
+        ConfigLog()->info("Config changed");
+    }
+
+    if(changed || !_certificateIndexLoaded)
+        loadCertificateIndex();
+
+    return changed;
+}
+
+bool Config::Private::loadCertificateIndex()
+{
+    PGconn* conn = checkConnected();
+    if(!conn)
+        return false;
+
+    PGresultPtr resultPtr(
+        PQexecParams(conn,
+            "select ID::text, CERTIFICATE "
+            "from DEVICES", 0, NULL, NULL, NULL, NULL, 1));
+    if(PQresultStatus(resultPtr.get()) != PGRES_TUPLES_OK) {
+        ConfigLog()->critical(
+            "Failed to retreive devices certificates: {}",
+            PQresultErrorMessage(resultPtr.get()));
+        return false;
+    }
+
+    PGresult* result = resultPtr.get();
+    const int rowCount = PQntuples(result);
+
+    _certificateIndex.clear();
+
+    for(int i = 0; i < rowCount; ++i) {
+        const char* ID = PQgetvalue(result, i, 0);
+        const char* CERTIFICATE = PQgetvalue(result, i, 1);
+
+        _certificateIndex.add(CERTIFICATE, ID);
+    }
+
+    _certificateIndexLoaded = true;
+
+    ConfigLog()->info("Loaded {} device certificates", _certificateIndex.size());
+
+    return true;
+}
+
+template<typename Certificate>
+bool Config::Private::authenticate(Certificate* cert, UserName* deviceId)
+{
+    // devices added to db become known after "config_changed" notification
+    // is handled by checkForUpdates
+    return _certificateIndex.find(cert, deviceId);
+}
+
 bool Config::Private::isDeviceExists(const DeviceId& deviceId)
 {
     if(deviceId.empty())
@@ -218,7 +326,7 @@ bool Config::Private::findDeviceSource(
 
     PGresultPtr resultPtr(
         PQexecParams(conn,
-            "select ID::text, URI, DROPBOX_STORAGE "
+            "select ID::text, URI, DROPBOX_STORAGE, LINGER "
             "from SOURCES "
             "where ID = $1 and DEVICE_ID = $2 "
             "limit 1", 2, NULL, paramValues, paramLengths, NULL, 1));
@@ -241,6 +349,10 @@ bool Config::Private::findDeviceSource(
         PQgetisnull(result, 0, 2) ?
             nullptr :
             PQgetvalue(result, 0, 2);
+    const void* LINGER =
+        PQgetisnull(result, 0, 3) ?
+            nullptr :
+            PQgetvalue(result, 0, 3);
 
     out->id.assign(ID);
     out->uri.assign(URI);
@@ -248,6 +360,10 @@ bool Config::Private::findDeviceSource(
         DROPBOX_STORAGE ?
         ntohl(*static_cast<const uint32_t*>(DROPBOX_STORAGE)) :
         0;
+    out->linger =
+        LINGER ?
+        ntohl(*static_cast<const uint32_t*>(LINGER)) :
+        DEFAULT_STREAM_LINGER;
 
     return true;
 }
@@ -270,7 +386,7 @@ void Config::Private::enumDeviceSources(
 
     PGresultPtr resultPtr(
         PQexecParams(conn,
-            "select ID::text, URI, DROPBOX_STORAGE "
+            "select ID::text, URI, DROPBOX_STORAGE, LINGER "
             "from SOURCES "
             "where DEVICE_ID = $1 "
             "limit 1", 1, NULL, paramValues, paramLengths, NULL, 1));
@@ -294,6 +410,10 @@ void Config::Private::enumDeviceSources(
             PQgetisnull(result, i, 2) ?
                 nullptr :
                 PQgetvalue(result, i, 2);
+        const void* LINGER =
+            PQgetisnull(result, i, 3) ?
+                nullptr :
+                PQgetvalue(result, i, 3);
 
         Source source;
         source.id.assign(ID);
@@ -302,6 +422,10 @@ void Config::Private::enumDeviceSources(
             DROPBOX_STORAGE ?
                 ntohl(*static_cast<const uint32_t*>(DROPBOX_STORAGE)) :
                 0;
+        source.linger =
+            LINGER ?
+                ntohl(*static_cast<const uint32_t*>(LINGER)) :
+                DEFAULT_STREAM_LINGER;
 
         if(!callback(source))
             return;
@@ -507,6 +631,16 @@ bool Config::Private::findUserSource(
 Config::Config() :
     _p(new Private)
 {
+    _p->_listening = false;
+    _p->_generation = 0;
+    _p->_certificateIndexLoaded = false;
+
+    // initial state is the one config is listened from,
+    // otherwise the first checkForUpdates would always report change
+    if(PGconn* conn = _p->checkConnected()) {
+        if(_p->listenConfigChanged(conn))
+            _p->loadCertificateIndex();
+    }
 }
 
 Config::~Config()
@@ -514,11 +648,21 @@ Config::~Config()
     _p.reset();
 }
 
-std::unique_ptr<const ::Server::Config::Config> Config::clone() const
+std::unique_ptr<::Server::Config::Config> Config::clone() const
 {
     return std::make_unique<Config>();
 }
 
+unsigned Config::generation() const
+{
+    return _p->_generation;
+}
+
+bool Config::checkForUpdates()
+{
+    return _p->checkForUpdates();
+}
+
 const ::Server::Config::Server* Config::serverConfig() const
 {
     if(!_p->_server.serverHost.empty())
@@ -530,7 +674,7 @@ const ::Server::Config::Server* Config::serverConfig() const
 
     PGresultPtr resultPtr(
         PQexecParams(conn,
-            "select HOST, CONTROL_PORT, STATIC_PORT, RESTREAM_PORT "
+            "select HOST, CONTROL_PORT, STATIC_PORT, RESTREAM_PORT, SPLASH, SNAPSHOT_PORT "
             "from SERVER "
             "limit 1", 0, NULL, NULL, NULL, NULL, 1));
     if(PQresultStatus(resultPtr.get()) != PGRES_TUPLES_OK) {
@@ -550,6 +694,14 @@ const ::Server::Config::Server* Config::serverConfig() const
     const void* CONTROL_PORT = PQgetvalue(result, 0, 1);
     const void* STATIC_PORT = PQgetvalue(result, 0, 2);
     const void* RESTREAM_PORT = PQgetvalue(result, 0, 3);
+    const char* SPLASH =
+        PQgetisnull(result, 0, 4) ?
+            nullptr :
+            PQgetvalue(result, 0, 4);
+    const void* SNAPSHOT_PORT =
+        PQgetisnull(result, 0, 5) ?
+            nullptr :
+            PQgetvalue(result, 0, 5);
 
     _p->_server.serverHost = HOST;
     _p->_server.controlServerPort =
@@ -558,6 +710,11 @@ const ::Server::Config::Server* Config::serverConfig() const
         ntohs(*static_cast<const uint16_t*>(STATIC_PORT));
     _p->_server.restreamServerPort=
         ntohs(*static_cast<const uint16_t*>(RESTREAM_PORT));
+    _p->_server.noSignalSplashSource = SPLASH ? SPLASH : "";
+    _p->_server.snapshotServerPort =
+        SNAPSHOT_PORT ?
+            ntohs(*static_cast<const uint16_t*>(SNAPSHOT_PORT)) :
+            DEFAULT_SNAPSHOT_SERVER_PORT;
 
     return &_p->_server;
 }
@@ -591,109 +748,14 @@ std::string Config::certificate() const
     return std::string(CERTIFICATE);
 }
 
-X509Ptr makeCertificate(const char* pemCertificate)
-{
-    X509Ptr nullPtr;
-
-    BIOPtr certBioPtr(BIO_new(BIO_s_mem()));
-    BIO* certBio = certBioPtr.get();
-    if(!certBio) {
-        ConfigLog()->error("BIO_new failed");
-        return std::move(nullPtr);
-    }
-
-    if(BIO_puts(certBio, pemCertificate) <= 0) {
-        ConfigLog()->error("BIO_write failed");
-        return std::move(nullPtr);
-    }
-
-    X509Ptr x509CertPtr(PEM_read_bio_X509(certBio, NULL, NULL, NULL));
-    X509* x509Cert = x509CertPtr.get();
-    if(!x509Cert) {
-        ConfigLog()->error("Failed parse client certificate");
-        return std::move(nullPtr);
-    }
-
-    return std::move(x509CertPtr);
-}
-
 bool Config::authenticate(X509* cert, UserName* userName) const
 {
-    X509_NAME* subject = X509_get_subject_name(cert);
-    if(!subject) {
-        ConfigLog()->error("X509_get_subject_name failed");
-        return false;
-    }
-
-    const int nameIndex = X509_NAME_get_index_by_NID(subject, NID_commonName, -1);
-    if(nameIndex < 0) {
-        ConfigLog()->error("X509_NAME_get_entry failed");
-        return false;
-    }
-
-    X509_NAME_ENTRY* nameEntry = X509_NAME_get_entry(subject, nameIndex);
-    if(!nameEntry) {
-        ConfigLog()->error("X509_NAME_get_entry failed");
-        return false;
-    }
-
-    ASN1_STRING* asn1Name = X509_NAME_ENTRY_get_data(nameEntry);
-    if(!asn1Name) {
-        ConfigLog()->error("X509_NAME_ENTRY_get_data failed");
-        return false;
-    }
-
-    const unsigned char* commonName = ASN1_STRING_data(asn1Name);
-    if(!commonName) {
-        ConfigLog()->error("ASN1_STRING_get0_data failed");
-        return false;
-    }
-
-    ::Server::Config::Device device;
-    if(!_p->findDevice(reinterpret_cast<const std::string::value_type*>(commonName), &device)) {
-        ConfigLog()->error(
-            "Failed find device by certificate. Name \"{}\"",
-            commonName);
-        return false;
-    }
-
-    X509Ptr x509DeviceCertPtr = makeCertificate(device.certificate.data());
-    X509* x509DeviceCert = x509DeviceCertPtr.get();
-    if(!x509DeviceCert)
-        return false;
-
-    if(X509_cmp(cert, x509DeviceCert) != 0) {
-        ConfigLog()->info(
-            "Received certificate differ from certificate stored on server. Name {}",
-            commonName);
-        return false;
-    }
-
-    ConfigLog()->info("Client certificate is allowed. Subject: {}", commonName);
-
-    if(userName)
-        *userName = reinterpret_cast<const std::string::value_type*>(commonName);
-
-    return true;
+    return _p->authenticate(cert, userName);
 }
 
 bool Config::authenticate(GTlsCertificate* cert, UserName* userName) const
 {
-    gchar* pemCertificate;
-    g_object_get(cert, "certificate-pem", &pemCertificate, NULL);
-    if(!pemCertificate) {
-        ConfigLog()->error("certificate-pem access failed");
-        return false;
-    }
-
-    GCharPtr pemCertificatePtr(pemCertificate);
-
-    X509Ptr x509CertPtr = makeCertificate(pemCertificate);
-    X509* x509Cert = x509CertPtr.get();
-    if(!x509Cert)
-        return false;
-
-    return authenticate(x509Cert, userName);
+    return _p->authenticate(cert, userName);
 }
 
 bool Config::findDevice(const DeviceId& deviceId, ::Server::Config::Device* out) const
@@ -21,7 +21,11 @@ public:
     Config();
     ~Config();
 
-    std::unique_ptr<const ::Server::Config::Config> clone() const override;
+    std::unique_ptr<::Server::Config::Config> clone() const override;
+
+    unsigned generation() const override;
+    // changes are reported by db with "NOTIFY config_changed"
+    bool checkForUpdates() override;
 
 
     const ::Server::Config::Server* serverConfig() const override;
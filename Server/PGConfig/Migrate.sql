@@ -0,0 +1,36 @@
+sudo -u restreamer_admin -i psql restreamer
+
+-- brings database created with older Server.sql up to date,
+-- every step can be applied repeatedly
+
+-- lets running server push changed configs to connected devices
+create or replace function NOTIFY_CONFIG_CHANGED() returns trigger as $$
+begin
+    notify config_changed;
+    return null;
+end;
+$$ language plpgsql;
+
+drop trigger if exists DEVICES_CHANGED on DEVICES;
+create trigger DEVICES_CHANGED after insert or update or delete on DEVICES
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+drop trigger if exists SOURCES_CHANGED on SOURCES;
+create trigger SOURCES_CHANGED after insert or update or delete on SOURCES
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+drop trigger if exists USERS_CHANGED on USERS;
+create trigger USERS_CHANGED after insert or update or delete on USERS
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+drop trigger if exists RIGHTS_CHANGED on RIGHTS;
+create trigger RIGHTS_CHANGED after insert or update or delete on RIGHTS
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+
+-- seconds to keep device streaming after last viewer left
+alter table SOURCES add column if not exists LINGER integer default null;
+
+-- no signal splash source served while device uplink is starting
+alter table SERVER add column if not exists SPLASH varchar(200) default null;
+
+-- snapshot server falls back to default port if null
+alter table SERVER add column if not exists SNAPSHOT_PORT smallint default null;
+
+\q
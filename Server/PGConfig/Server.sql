@@ -27,6 +27,8 @@ create table SERVER
     CONTROL_PORT smallint not null,
     STATIC_PORT smallint not null,
     RESTREAM_PORT smallint not null,
+    SPLASH varchar(200) default null,
+    SNAPSHOT_PORT smallint default null,
     CERTIFICATE text not null
 );
 
@@ -53,6 +55,7 @@ create table SOURCES
     ID uuid not null primary key default uuid_generate_v1mc(),
     URI varchar(200) not null,
     DROPBOX_STORAGE integer default null,
+    LINGER integer default null,
 
     DEVICE_ID uuid not null references DEVICES(ID)
 );
@@ -64,6 +67,23 @@ create table RIGHTS
     primary key(USER_ID, SOURCE_ID)
 );
 
+-- lets running server push changed configs to connected devices
+create function NOTIFY_CONFIG_CHANGED() returns trigger as $$
+begin
+    notify config_changed;
+    return null;
+end;
+$$ language plpgsql;
+
+create trigger DEVICES_CHANGED after insert or update or delete on DEVICES
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+create trigger SOURCES_CHANGED after insert or update or delete on SOURCES
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+create trigger USERS_CHANGED after insert or update or delete on USERS
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+create trigger RIGHTS_CHANGED after insert or update or delete on RIGHTS
+    for each statement execute procedure NOTIFY_CONFIG_CHANGED();
+
 grant select on all tables in schema PUBLIC to PUBLIC;
 grant usage, select on all sequences in schema PUBLIC to PUBLIC;
 
@@ -1,6 +1,10 @@
 #include "Server.h"
 
 #include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include <gst/gst.h>
 
@@ -8,6 +12,9 @@
 
 #include <RtspRestreamServer/RestreamServerLib/Server.h>
 
+#include <Common/LruCache.h>
+#include <Common/MpscQueue.h>
+
 #include "Log.h"
 
 
@@ -23,39 +30,339 @@ namespace {
 struct PathInfo {
     DeviceId deviceId;
     SourceId sourceId;
+    unsigned linger; // seconds
     bool hasPlayers;
     bool hasRecorder;
 };
 
+struct SourceAccess {
+    bool allowPlay;
+    bool allowRecord;
+};
+
+struct SourceEvent {
+    enum Type {
+        FirstReaderConnected,
+        LastReaderDisconnected,
+    };
+
+    Type type;
+    DeviceId deviceId;
+    SourceId sourceId;
+    unsigned linger; // seconds
+};
+
+// config clone with count of config changes it was synchronized with
+struct PooledConfig {
+    std::unique_ptr<::Server::Config::Config> config;
+    unsigned configChanges;
+};
+
+enum {
+    AUTH_CACHE_SIZE = 1024,
+    AUTH_CACHE_TTL = 10, // seconds
+
+    SOURCE_EVENTS_QUEUE_SIZE = 4096,
+};
+
 }
 
 struct Server::Private
 {
     Private(
         asio::io_service*,
-        const ::Server::Config::Config* config);
+        const ::Server::Config::Config* config,
+        ::Server::Config::CredentialsCache*);
+
+    class ConfigLease;
 
     asio::io_service* ioService;
 
-    std::unique_ptr<const ::Server::Config::Config> config;
+    // config is used from ioService thread and by RTSP server thread
+    // while it's started, configMutex guards it against concurrent certificate update
+    std::mutex configMutex;
+    std::unique_ptr<::Server::Config::Config> config;
+
+    // incremented every time config change is detected,
+    // to let pooled clones and caches catch up
+    std::atomic<unsigned> configChanges;
+
+    // RTSP server callbacks could be called from several threads,
+    // but config backend is not required to be thread safe,
+    // so every callback leases it's own clone (and db connection) from pool
+    std::mutex configPoolMutex;
+    std::vector<PooledConfig> configPool;
+
+    // caches - by cachesMutex,
+    // pathsInfo - by pathsMutex
+    std::mutex cachesMutex;
+    std::mutex pathsMutex;
 
     asio::steady_timer updateCertificateTimer;
+    asio::steady_timer checkConfigTimer;
 
     std::function<Server::SourceCallback> firstReaderConnectedCallback;
     std::function<Server::SourceCallback> lastReaderDisconnectedCallback;
 
+    // events from RTSP server thread are delivered to ioService thread
+    MpscQueue<SourceEvent> sourceEvents;
+    std::atomic<bool> dispatchScheduled;
+
+    // sources without viewers which are still streamed from device,
+    // accessed only from ioService thread
+    std::map<
+        std::pair<DeviceId, SourceId>,
+        std::unique_ptr<asio::steady_timer>> lingeringSources;
+
     std::thread serverThread;
     std::unique_ptr<RestreamServerLib::Server> restreamServer;
 
     std::map<std::string, PathInfo> pathsInfo;
+
+    unsigned cachesConfigChanges;
+    // (user, source) -> what user is allowed to do with source
+    LruCache<std::string, SourceAccess> accessCache;
+
+    ::Server::Config::CredentialsCache *const credentialsCache;
+
+    PooledConfig acquireConfig();
+    void releaseConfig(PooledConfig&&);
+
+    // should be called with cachesMutex locked
+    void checkConfigChanges();
+    // config clone is leased only on cache miss
+    SourceAccess sourceAccess(const UserName&, const SourceId&);
+
+    void postSourceEvent(
+        SourceEvent::Type,
+        const DeviceId&,
+        const SourceId&,
+        unsigned linger = 0);
+    void dispatchSourceEvents();
+    void firstReaderConnected(const DeviceId&, const SourceId&);
+    void lastReaderDisconnected(const DeviceId&, const SourceId&, unsigned linger);
+};
+
+// returns config clone to pool on destruction
+class Server::Private::ConfigLease
+{
+public:
+    ConfigLease(Private* owner) :
+        _owner(owner), _pooled(owner->acquireConfig()) {}
+    ~ConfigLease()
+        { _owner->releaseConfig(std::move(_pooled)); }
+
+    ConfigLease(const ConfigLease&) = delete;
+    ConfigLease& operator = (const ConfigLease&) = delete;
+
+    ::Server::Config::Config* operator -> () const
+        { return _pooled.config.get(); }
+
+    unsigned configChanges() const
+        { return _pooled.configChanges; }
+
+private:
+    Private *const _owner;
+    PooledConfig _pooled;
 };
 
 Server::Private::Private(
     asio::io_service* ioService,
-    const ::Server::Config::Config* config) :
+    const ::Server::Config::Config* config,
+    ::Server::Config::CredentialsCache* credentialsCache) :
     ioService(ioService), config(config->clone()),
-    updateCertificateTimer(*ioService)
+    configChanges(0),
+    updateCertificateTimer(*ioService),
+    checkConfigTimer(*ioService),
+    sourceEvents(SOURCE_EVENTS_QUEUE_SIZE),
+    dispatchScheduled(false),
+    cachesConfigChanges(0),
+    accessCache(AUTH_CACHE_SIZE, std::chrono::seconds(AUTH_CACHE_TTL)),
+    credentialsCache(credentialsCache)
+{
+}
+
+PooledConfig Server::Private::acquireConfig()
+{
+    PooledConfig pooled;
+    {
+        std::lock_guard<std::mutex> lock(configPoolMutex);
+        if(!configPool.empty()) {
+            pooled = std::move(configPool.back());
+            configPool.pop_back();
+        }
+    }
+
+    const unsigned changes = configChanges.load();
+
+    if(!pooled.config) {
+        // clone doesn't depend on state of config it's made from,
+        // so configMutex is not required here
+        pooled.config = config->clone();
+    } else if(pooled.configChanges != changes)
+        pooled.config->checkForUpdates();
+
+    pooled.configChanges = changes;
+
+    return pooled;
+}
+
+void Server::Private::releaseConfig(PooledConfig&& pooled)
+{
+    std::lock_guard<std::mutex> lock(configPoolMutex);
+    configPool.push_back(std::move(pooled));
+}
+
+void Server::Private::checkConfigChanges()
+{
+    const unsigned changes = configChanges.load();
+    if(changes == cachesConfigChanges)
+        return;
+
+    cachesConfigChanges = changes;
+    accessCache.clear();
+}
+
+SourceAccess Server::Private::sourceAccess(
+    const UserName& userName,
+    const SourceId& sourceId)
+{
+    std::string key;
+    key.reserve(userName.size() + 1 + sourceId.size());
+    key += userName;
+    key += '\0';
+    key += sourceId;
+
+    {
+        std::lock_guard<std::mutex> lock(cachesMutex);
+        checkConfigChanges();
+
+        if(const SourceAccess* access = accessCache.find(key))
+            return *access;
+    }
+
+    const ConfigLease config(this);
+    const SourceAccess access {
+        .allowPlay = config->findUserSource(userName, sourceId),
+        .allowRecord = config->findDeviceSource(userName, sourceId),
+    };
+
+    std::lock_guard<std::mutex> lock(cachesMutex);
+    checkConfigChanges();
+    // result got from outdated clone is not cached
+    if(config.configChanges() == cachesConfigChanges)
+        accessCache.put(key, access);
+
+    return access;
+}
+
+void Server::Private::postSourceEvent(
+    SourceEvent::Type type,
+    const DeviceId& deviceId,
+    const SourceId& sourceId,
+    unsigned linger)
+{
+    SourceEvent event { type, deviceId, sourceId, linger };
+
+    // it's better to slow down RTSP thread a bit than lose or reorder events
+    if(!sourceEvents.push(std::move(event))) {
+        RestreamServer::Log()->warn("Source events queue is full");
+        while(!sourceEvents.push(std::move(event)))
+            std::this_thread::yield();
+    }
+
+    // events arrived until dispatch is started will be handled together
+    if(!dispatchScheduled.exchange(true))
+        ioService->post(std::bind(&Server::Private::dispatchSourceEvents, this));
+}
+
+void Server::Private::dispatchSourceEvents()
+{
+    dispatchScheduled.store(false);
+
+    std::vector<SourceEvent> events;
+    SourceEvent event;
+    while(sourceEvents.pop(&event))
+        events.push_back(std::move(event));
+
+    // source's events always alternate,
+    // so only last one matters and even count of them cancels out
+    struct SourceEvents {
+        size_t last;
+        unsigned count;
+    };
+    std::map<std::pair<DeviceId, SourceId>, SourceEvents> sources;
+    for(size_t i = 0; i < events.size(); ++i) {
+        SourceEvents& sourceEvents =
+            sources[std::make_pair(events[i].deviceId, events[i].sourceId)];
+        sourceEvents.last = i;
+        ++sourceEvents.count;
+    }
+
+    for(size_t i = 0; i < events.size(); ++i) {
+        const SourceEvent& event = events[i];
+
+        const SourceEvents& sourceEvents =
+            sources[std::make_pair(event.deviceId, event.sourceId)];
+        if(sourceEvents.last != i || sourceEvents.count % 2 == 0)
+            continue;
+
+        switch(event.type) {
+            case SourceEvent::FirstReaderConnected:
+                firstReaderConnected(event.deviceId, event.sourceId);
+                break;
+            case SourceEvent::LastReaderDisconnected:
+                lastReaderDisconnected(event.deviceId, event.sourceId, event.linger);
+                break;
+        }
+    }
+}
+
+void Server::Private::firstReaderConnected(
+    const DeviceId& deviceId,
+    const SourceId& sourceId)
 {
+    auto it = lingeringSources.find(std::make_pair(deviceId, sourceId));
+    if(lingeringSources.end() != it) {
+        RestreamServer::Log()->debug(
+            "Viewer returned to lingering source. Device: {}, source: {}",
+            deviceId, sourceId);
+        // device is still streaming, so there is nothing to request
+        lingeringSources.erase(it);
+        return;
+    }
+
+    if(firstReaderConnectedCallback)
+        firstReaderConnectedCallback(deviceId, sourceId);
+}
+
+void Server::Private::lastReaderDisconnected(
+    const DeviceId& deviceId,
+    const SourceId& sourceId,
+    unsigned linger)
+{
+    if(!linger) {
+        if(lastReaderDisconnectedCallback)
+            lastReaderDisconnectedCallback(deviceId, sourceId);
+        return;
+    }
+
+    const std::pair<DeviceId, SourceId> key(deviceId, sourceId);
+
+    std::unique_ptr<asio::steady_timer>& timer = lingeringSources[key];
+    timer.reset(new asio::steady_timer(*ioService));
+    timer->expires_from_now(std::chrono::seconds(linger));
+    timer->async_wait(
+        [this, key] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            lingeringSources.erase(key);
+
+            if(lastReaderDisconnectedCallback)
+                lastReaderDisconnectedCallback(key.first, key.second);
+        }
+    );
 }
 
 
@@ -66,12 +373,14 @@ const std::shared_ptr<spdlog::logger>& Server::Log()
 
 Server::Server(
     asio::io_service* ioService,
-    const ::Server::Config::Config* config) :
-    _p(new Private(ioService, config))
+    const ::Server::Config::Config* config,
+    ::Server::Config::CredentialsCache* credentialsCache) :
+    _p(new Private(ioService, config, credentialsCache))
 {
     gst_init(0, nullptr);
 
     scheduleUpdateCertificate();
+    scheduleCheckConfig();
 }
 
 Server::~Server()
@@ -106,7 +415,20 @@ void Server::serverMain()
 
     GST_PLUGIN_STATIC_REGISTER(interpipe);
 
-    const ::Server::Config::Server& config = *_p->config->serverConfig();
+    ::Server::Config::Server config;
+    {
+        std::lock_guard<std::mutex> lock(_p->configMutex);
+        config = *_p->config->serverConfig();
+    }
+
+    // RestreamServerLib has no way to serve splash yet,
+    // so only make misconfiguration visible early
+    if(!config.noSignalSplashSource.empty()) {
+        if(gst_uri_is_valid(config.noSignalSplashSource.c_str()))
+            Log()->info("No signal splash source: {}", config.noSignalSplashSource);
+        else
+            Log()->error("Invalid no signal splash source: {}", config.noSignalSplashSource);
+    }
 
     Callbacks callbacks;
     callbacks.tlsAuthenticate =
@@ -170,7 +492,11 @@ bool Server::updateCertificate()
 {
     Log()->trace(">> ServerSecureContext::updateCertificate");
 
-    const std::string certificate = _p->config->certificate();
+    std::string certificate;
+    {
+        std::lock_guard<std::mutex> lock(_p->configMutex);
+        certificate = _p->config->certificate();
+    }
 
     if(certificate.empty()) {
         Log()->critical("Empty ceritficate");
@@ -214,11 +540,38 @@ void Server::scheduleUpdateCertificate()
     );
 }
 
+void Server::scheduleCheckConfig()
+{
+    _p->checkConfigTimer.expires_from_now(std::chrono::seconds(CONFIG_CHECK_INTERVAL));
+    _p->checkConfigTimer.async_wait(
+        [this] (const asio::error_code& error) {
+            if(error)
+                return;
+
+            bool changed;
+            {
+                std::lock_guard<std::mutex> lock(_p->configMutex);
+                changed = _p->config->checkForUpdates();
+            }
+
+            // pooled clones and caches catch up on next use
+            if(changed) {
+                ++_p->configChanges;
+                _p->credentialsCache->invalidate();
+            }
+
+            scheduleCheckConfig();
+        }
+    );
+}
+
 bool Server::tlsAuthenticate(GTlsCertificate* cert, UserName* userName)
 {
     Log()->trace(">> Server::authenticate. With certificate.");
 
-    return _p->config->authenticate(cert, userName);
+    Private::ConfigLease config(_p.get());
+
+    return config->authenticate(cert, userName);
 }
 
 bool Server::authenticationRequired(
@@ -232,7 +585,10 @@ bool Server::authenticationRequired(
     if(sourceId.empty())
         return true;
 
-    if(!record && _p->config->findUserSource(UserName(), sourceId)) {
+    const bool allowPlay =
+        _p->sourceAccess(UserName(), sourceId).allowPlay;
+
+    if(!record && allowPlay) {
         Log()->trace("SourceId \"{}\" DOES NOT require authentication as anonymous", sourceId);
         return false;
     }
@@ -252,10 +608,19 @@ bool Server::authenticate(const std::string& userName, const std::string& pass)
     if(!_p->config)
         return false;
 
-    std::string name(userName);
+    if(_p->credentialsCache->find(userName, pass)) {
+        Log()->debug("User \"{}\" authenticated", userName);
+        return true;
+    }
+
+    // taken before config is leased,
+    // so credentials checked with outdated config are not cached
+    const unsigned credentialsGeneration = _p->credentialsCache->generation();
+
+    Private::ConfigLease config(_p.get());
 
     ::Server::Config::User user;
-    if(!_p->config->findUser(userName, &user)) {
+    if(!config->findUser(userName, &user)) {
         Log()->info("User \"{}\" not found", userName);
         return false;
     }
@@ -275,6 +640,8 @@ bool Server::authenticate(const std::string& userName, const std::string& pass)
         return false;
     }
 
+    _p->credentialsCache->put(credentialsGeneration, userName, pass);
+
     Log()->debug("User \"{}\" authenticated", userName);
 
     return true;
@@ -298,8 +665,11 @@ bool Server::authorize(
         return false;
     }
 
-    const bool allowPlay = _p->config->findUserSource(userName, sourceId);
-    const bool allowRecord = _p->config->findDeviceSource(userName, sourceId);
+    const SourceAccess access =
+        _p->sourceAccess(userName, sourceId);
+
+    const bool allowPlay = access.allowPlay;
+    const bool allowRecord = access.allowRecord;
     if(allowPlay && allowRecord) {
         Log()->error("User and Device have the same name: {}", userName);
         return false;
@@ -331,21 +701,16 @@ bool Server::authorize(
 
 SourceId Server::extractSourceId(const std::string& path) const
 {
-    SourceId sourceId;
+    // source id is the first path segment: "/<sourceId>/..."
+    const std::string::size_type begin = path.find('/');
+    if(std::string::npos == begin)
+        return SourceId();
 
-    gchar** tokens = g_strsplit(path.data(), "/", 3);
-    for(unsigned i = 0; i < 2 && tokens[i] != NULL; ++i) {
-        switch(i) {
-            case 0:
-                break;
-            case 1:
-                sourceId = tokens[1];
-                break;
-        }
-    }
-    g_strfreev(tokens);
+    const std::string::size_type end = path.find('/', begin + 1);
+    if(std::string::npos == end)
+        return path.substr(begin + 1);
 
-    return sourceId;
+    return path.substr(begin + 1, end - begin - 1);
 }
 
 void Server::firstPlayerConnected(const UserName& userName, const std::string& path)
@@ -356,14 +721,27 @@ void Server::firstPlayerConnected(const UserName& userName, const std::string& p
 
     const SourceId sourceId =  extractSourceId(path);
 
+    // config is looked up before pathsMutex is taken,
+    // so linger is also looked up here to not query config on disconnect
     ::Server::Config::PlaySource playSource;
-    if(!_p->config->findUserSource(userName, sourceId, &playSource)) {
-        Log()->critical(
-            "fail find PlaySource for {}",
-            path);
-        return;
+    ::Server::Config::Source source;
+    unsigned linger = 0;
+    {
+        Private::ConfigLease config(_p.get());
+        if(!config->findUserSource(userName, sourceId, &playSource)) {
+            Log()->critical(
+                "fail find PlaySource for {}",
+                path);
+            return;
+        }
+
+        if(config->findDeviceSource(playSource.deviceId, playSource.sourceId, &source))
+            linger = source.linger;
     }
 
+    // events are posted under lock to keep them in the same order as path state changes
+    std::lock_guard<std::mutex> lock(_p->pathsMutex);
+
     auto pathIt = _p->pathsInfo.find(path);
     if(pathIt == _p->pathsInfo.end()) {
         assert(sourceId == playSource.sourceId);
@@ -371,14 +749,19 @@ void Server::firstPlayerConnected(const UserName& userName, const std::string& p
             PathInfo {
                 .deviceId = playSource.deviceId,
                 .sourceId = playSource.sourceId,
+                .linger = linger,
                 .hasPlayers = true,
                 .hasRecorder = false,
             });
-    } else
+    } else {
+        pathIt->second.linger = linger;
         pathIt->second.hasPlayers = true;
+    }
 
-    if(_p->firstReaderConnectedCallback)
-        _p->firstReaderConnectedCallback(playSource.deviceId, playSource.sourceId);
+    _p->postSourceEvent(
+        SourceEvent::FirstReaderConnected,
+        playSource.deviceId,
+        playSource.sourceId);
 }
 
 void Server::lastPlayerDisconnected(const std::string& path)
@@ -387,6 +770,8 @@ void Server::lastPlayerDisconnected(const std::string& path)
         ">> Server.lastPlayerDisconnected. path: {}",
         path);
 
+    std::lock_guard<std::mutex> lock(_p->pathsMutex);
+
     auto pathIt = _p->pathsInfo.find(path);
     assert(pathIt != _p->pathsInfo.end());
     if(pathIt == _p->pathsInfo.end())
@@ -397,10 +782,11 @@ void Server::lastPlayerDisconnected(const std::string& path)
     assert(pathIt->second.hasPlayers);
     pathIt->second.hasPlayers = false;
 
-    if(_p->lastReaderDisconnectedCallback)
-        _p->lastReaderDisconnectedCallback(
-            pathIt->second.deviceId,
-            pathIt->second.sourceId);
+    _p->postSourceEvent(
+        SourceEvent::LastReaderDisconnected,
+        pathIt->second.deviceId,
+        pathIt->second.sourceId,
+        pathIt->second.linger);
 
     if(!pathIt->second.hasPlayers && !pathIt->second.hasRecorder)
         _p->pathsInfo.erase(pathIt);
@@ -415,19 +801,22 @@ void Server::recorderConnected(const UserName& userName, const std::string& path
     SourceId sourceId =  extractSourceId(path);
 
     ::Server::Config::Source source;
-    if(!_p->config->findDeviceSource(userName, sourceId, &source)) {
+    if(!Private::ConfigLease(_p.get())->findDeviceSource(userName, sourceId, &source)) {
         Log()->critical(
             "fail find Source for {}",
             path);
         return;
     }
 
+    std::lock_guard<std::mutex> lock(_p->pathsMutex);
+
     auto pathIt = _p->pathsInfo.find(path);
     if(pathIt == _p->pathsInfo.end()) {
         _p->pathsInfo.emplace(path,
             PathInfo {
                 .deviceId = userName,
                 .sourceId = source.id,
+                .linger = source.linger,
                 .hasPlayers = false,
                 .hasRecorder = true,
             });
@@ -443,6 +832,8 @@ void Server::recorderDisconnected(const std::string& path)
         ">> Server.recorderDisconnected. path: {}",
         path);
 
+    std::lock_guard<std::mutex> lock(_p->pathsMutex);
+
     auto pathIt = _p->pathsInfo.find(path);
     assert(pathIt != _p->pathsInfo.end());
     if(pathIt == _p->pathsInfo.end())
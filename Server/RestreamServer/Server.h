@@ -15,6 +15,7 @@
 
 #include "Log.h"
 #include "Config/Config.h"
+#include "Config/CredentialsCache.h"
 
 
 namespace RestreamServer
@@ -25,14 +26,18 @@ class Server
 public:
     typedef void (SourceCallback) (const std::string& deviceName, const std::string& sourceName);
 
+    // credentials cache is shared with other servers
+    // using the same play credentials
     Server(
         asio::io_service*,
-        const ::Server::Config::Config*);
+        const ::Server::Config::Config*,
+        ::Server::Config::CredentialsCache*);
 
     ~Server();
 
     const ::Server::Config::Config* config() const;
 
+    // callbacks are called from ioService thread
     void runServer(
         const std::function<SourceCallback>& firstReaderConnectedCallback,
         const std::function<SourceCallback>& lastReaderDisconnectedCallback);
@@ -48,6 +53,8 @@ private:
     bool updateCertificate();
     void scheduleUpdateCertificate();
 
+    void scheduleCheckConfig();
+
     bool tlsAuthenticate(GTlsCertificate*, UserName*);
     bool authenticationRequired(GstRTSPMethod method, const std::string& path, bool record);
     bool authenticate(const std::string& userName, const std::string& pass);
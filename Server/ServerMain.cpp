@@ -7,7 +7,9 @@
 #include "Log.h"
 
 #include "ControlServer/Server.h"
+#include "ControlServer/SnapshotServer.h"
 #include "RestreamServer/Server.h"
+#include "Config/CredentialsCache.h"
 
 
 void ServerMain(
@@ -17,8 +19,13 @@ void ServerMain(
 {
     InitServerLoggers(daemon);
 
+    // restream and snapshot servers check the same play credentials
+    Server::Config::CredentialsCache credentialsCache;
+
     ControlServer::Server server(ioService, config);
-    RestreamServer::Server restreamServer(ioService, config);
+    RestreamServer::Server restreamServer(ioService, config, &credentialsCache);
+    ControlServer::SnapshotServer snapshotServer(
+        ioService, config, &credentialsCache, &server);
 
     const std::string restreamServerUrl =
         fmt::format(
@@ -42,6 +49,7 @@ void ServerMain(
         };
 
     server.startAccept();
+    snapshotServer.startAccept();
     restreamServer.runServer(firstReaderConnected, lastReaderDisconnected);
 
     /*
@@ -0,0 +1,149 @@
+#include <thread>
+
+#include "Server/ControlServer/AdmissionGate.h"
+
+#include "Check.h"
+
+
+namespace
+{
+
+using ControlServer::AdmissionGate;
+
+typedef std::shared_ptr<asio::ip::tcp::socket> SocketPtr;
+
+struct Admitted
+{
+    std::vector<AdmissionGate::Ticket> tickets;
+    std::vector<AdmissionGate::Ticket> rejectingTickets;
+};
+
+std::shared_ptr<AdmissionGate> MakeGate(asio::io_service* ioService, Admitted* admitted)
+{
+    return
+        std::make_shared<AdmissionGate>(
+            ioService,
+            [admitted] (
+                const SocketPtr&,
+                const AdmissionGate::Ticket& ticket,
+                bool overloaded)
+            {
+                if(overloaded)
+                    admitted->rejectingTickets.push_back(ticket);
+                else
+                    admitted->tickets.push_back(ticket);
+            });
+}
+
+SocketPtr MakeSocket(asio::io_service* ioService, bool open = false)
+{
+    SocketPtr socket = std::make_shared<asio::ip::tcp::socket>(*ioService);
+    if(open)
+        socket->open(asio::ip::tcp::v4());
+
+    return socket;
+}
+
+}
+
+UNIT_TEST(AdmissionGateTokenBucket)
+{
+    asio::io_service ioService;
+    Admitted admitted;
+    std::shared_ptr<AdmissionGate> gate = MakeGate(&ioService, &admitted);
+
+    enum {
+        EXTRA = 10,
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for(unsigned i = 0; i < AdmissionGate::HANDSHAKES_BURST + EXTRA; ++i)
+        gate->enqueue(MakeSocket(&ioService));
+
+    // burst is admitted at once, the rest waits for tokens
+    CHECK(admitted.tickets.size() >= AdmissionGate::HANDSHAKES_BURST);
+    CHECK(admitted.tickets.size() < AdmissionGate::HANDSHAKES_BURST + EXTRA);
+
+    while(admitted.tickets.size() < AdmissionGate::HANDSHAKES_BURST + EXTRA)
+        ioService.run_one();
+
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // with some slack for timers accuracy
+    CHECK(elapsed.count() >= 0.8 * EXTRA / AdmissionGate::HANDSHAKES_RATE);
+
+    CHECK(admitted.rejectingTickets.empty());
+}
+
+UNIT_TEST(AdmissionGateConcurrencyAndDeadline)
+{
+    asio::io_service ioService;
+    Admitted admitted;
+    std::shared_ptr<AdmissionGate> gate = MakeGate(&ioService, &admitted);
+
+    for(unsigned i = 0; i < AdmissionGate::MAX_CONCURRENT_HANDSHAKES; ++i)
+        gate->enqueue(MakeSocket(&ioService));
+
+    while(admitted.tickets.size() < AdmissionGate::MAX_CONCURRENT_HANDSHAKES)
+        ioService.run_one();
+
+    std::vector<SocketPtr> pending;
+    for(unsigned i = 0; i < 3; ++i) {
+        pending.push_back(MakeSocket(&ioService, true));
+        gate->enqueue(pending.back());
+    }
+
+    // tokens are available, but all handshake slots are taken
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ioService.poll();
+    CHECK(AdmissionGate::MAX_CONCURRENT_HANDSHAKES == admitted.tickets.size());
+    for(const SocketPtr& socket: pending)
+        CHECK(socket->is_open());
+
+    std::this_thread::sleep_for(
+        std::chrono::seconds(AdmissionGate::PENDING_TIMEOUT) +
+        std::chrono::milliseconds(100));
+    // finished handshake frees slot, but pending connections are already expired
+    admitted.tickets.pop_back();
+    ioService.poll();
+
+    CHECK(AdmissionGate::MAX_CONCURRENT_HANDSHAKES - 1 == admitted.tickets.size());
+    for(const SocketPtr& socket: pending)
+        CHECK(!socket->is_open());
+}
+
+UNIT_TEST(AdmissionGateOverload)
+{
+    asio::io_service ioService;
+    Admitted admitted;
+    std::shared_ptr<AdmissionGate> gate = MakeGate(&ioService, &admitted);
+
+    const unsigned maxConnections =
+        AdmissionGate::HANDSHAKES_BURST + AdmissionGate::MAX_PENDING_CONNECTIONS + 100;
+    for(unsigned i = 0; i < maxConnections && admitted.rejectingTickets.empty(); ++i)
+        gate->enqueue(MakeSocket(&ioService));
+
+    CHECK(1 == admitted.rejectingTickets.size());
+    CHECK(
+        AdmissionGate::MAX_PENDING_CONNECTIONS / AdmissionGate::HANDSHAKES_RATE ==
+        gate->retryAfterHint());
+
+    for(unsigned i = 0; i < AdmissionGate::MAX_REJECTING_HANDSHAKES; ++i)
+        gate->enqueue(MakeSocket(&ioService));
+
+    // connections over rejecting handshakes limit are shed
+    CHECK(AdmissionGate::MAX_REJECTING_HANDSHAKES == admitted.rejectingTickets.size());
+
+    // finished rejecting handshake lets next one be rejected with hint again
+    admitted.rejectingTickets.pop_back();
+    ioService.poll();
+    // pending queue could get a bit of room meanwhile
+    for(unsigned i = 0;
+        i < 10 && admitted.rejectingTickets.size() < AdmissionGate::MAX_REJECTING_HANDSHAKES;
+        ++i)
+    {
+        gate->enqueue(MakeSocket(&ioService));
+    }
+    CHECK(AdmissionGate::MAX_REJECTING_HANDSHAKES == admitted.rejectingTickets.size());
+}
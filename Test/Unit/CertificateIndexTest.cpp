@@ -0,0 +1,129 @@
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <CxxPtr/OpenSSLPtr.h>
+
+#include "Server/Config/CertificateIndex.h"
+
+#include "Check.h"
+
+
+// self signed certificate valid within [now + notBefore, now + notAfter] seconds
+static X509Ptr MakeCertificate(long notBefore, long notAfter)
+{
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_CTX* keyCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    if(!keyCtx ||
+       EVP_PKEY_keygen_init(keyCtx) <= 0 ||
+       EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyCtx, NID_X9_62_prime256v1) <= 0 ||
+       EVP_PKEY_keygen(keyCtx, &key) <= 0)
+    {
+        EVP_PKEY_CTX_free(keyCtx);
+        return X509Ptr();
+    }
+    EVP_PKEY_CTX_free(keyCtx);
+
+    X509Ptr certPtr(X509_new());
+    X509* cert = certPtr.get();
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), notBefore);
+    X509_gmtime_adj(X509_get_notAfter(cert), notAfter);
+    X509_set_pubkey(cert, key);
+
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(
+        name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>("device"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+
+    const bool isSigned = X509_sign(cert, key, EVP_sha256()) > 0;
+
+    EVP_PKEY_free(key);
+
+    if(!isSigned)
+        return X509Ptr();
+
+    return certPtr;
+}
+
+static std::string ToPem(X509* cert)
+{
+    BIOPtr bioPtr(BIO_new(BIO_s_mem()));
+    PEM_write_bio_X509(bioPtr.get(), cert);
+
+    char* data = nullptr;
+    const long size = BIO_get_mem_data(bioPtr.get(), &data);
+
+    return std::string(data, size);
+}
+
+UNIT_TEST(CertificateIndexLookup)
+{
+    using namespace Server::Config;
+
+    enum {
+        DAY = 24 * 60 * 60, // seconds
+    };
+
+    X509Ptr firstPtr = MakeCertificate(-DAY, DAY);
+    X509Ptr secondPtr = MakeCertificate(-DAY, DAY);
+    X509Ptr unknownPtr = MakeCertificate(-DAY, DAY);
+    CHECK(firstPtr && secondPtr && unknownPtr);
+    if(!firstPtr || !secondPtr || !unknownPtr)
+        return;
+
+    CertificateIndex index;
+    CHECK(index.empty());
+
+    CHECK(index.add(ToPem(firstPtr.get()), "first"));
+    CHECK(index.add(ToPem(secondPtr.get()), "second"));
+    CHECK(2 == index.size());
+
+    CHECK(!index.add(std::string(), "empty"));
+    CHECK(!index.add("not a certificate", "garbage"));
+    // the same certificate can't belong to another device
+    CHECK(!index.add(ToPem(firstPtr.get()), "third"));
+    CHECK(2 == index.size());
+
+    DeviceId deviceId;
+    CHECK(index.find(firstPtr.get(), &deviceId) && "first" == deviceId);
+    CHECK(index.find(secondPtr.get(), &deviceId) && "second" == deviceId);
+    CHECK(!index.find(unknownPtr.get(), &deviceId));
+
+    index.clear();
+    CHECK(index.empty());
+    CHECK(!index.find(firstPtr.get(), &deviceId));
+}
+
+UNIT_TEST(CertificateIndexValidityWindow)
+{
+    using namespace Server::Config;
+
+    enum {
+        DAY = 24 * 60 * 60, // seconds
+    };
+
+    X509Ptr validPtr = MakeCertificate(-DAY, DAY);
+    X509Ptr notYetValidPtr = MakeCertificate(DAY, 2 * DAY);
+    X509Ptr expiredPtr = MakeCertificate(-2 * DAY, -DAY);
+    CHECK(validPtr && notYetValidPtr && expiredPtr);
+    if(!validPtr || !notYetValidPtr || !expiredPtr)
+        return;
+
+    CertificateIndex index;
+    CHECK(index.add(ToPem(validPtr.get()), "valid"));
+    CHECK(index.add(ToPem(notYetValidPtr.get()), "notYetValid"));
+    CHECK(index.add(ToPem(expiredPtr.get()), "expired"));
+
+    DeviceId deviceId;
+    CHECK(index.find(validPtr.get(), &deviceId) && "valid" == deviceId);
+
+    deviceId.clear();
+    CHECK(!index.find(notYetValidPtr.get(), &deviceId));
+    CHECK(!index.find(expiredPtr.get(), &deviceId));
+    CHECK(deviceId.empty());
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+
+namespace UnitTest
+{
+
+struct Test
+{
+    const char* name;
+    void (*run)();
+};
+
+std::vector<Test>& Tests();
+
+void Fail(const char* file, int line, const char* condition);
+
+struct Registrar
+{
+    Registrar(const char* name, void (*run)())
+        { Tests().push_back(Test { name, run }); }
+};
+
+}
+
+// defines test function and registers it to be run from main()
+#define UNIT_TEST(name) \
+    static void name(); \
+    static UnitTest::Registrar name##Registrar(#name, &name); \
+    static void name()
+
+// reports failure and continues with the test
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) \
+            UnitTest::Fail(__FILE__, __LINE__, #condition); \
+    } while(false)
@@ -0,0 +1,99 @@
+#include <algorithm>
+
+#include "DeviceBox/Config.h"
+
+#include "Check.h"
+
+
+namespace
+{
+
+void AddSource(
+    Protocol::ClientConfig* config,
+    const std::string& id,
+    const std::string& uri)
+{
+    Protocol::VideoSource* source = config->add_sources();
+    source->set_id(id);
+    source->set_uri(uri);
+}
+
+bool Contains(const std::vector<std::string>& ids, const std::string& id)
+{
+    return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+std::string SourceField(
+    DeviceBox::Config* config,
+    const std::string& id,
+    std::string DeviceBox::SourceConfig::* field)
+{
+    std::string value;
+    config->findSource(id,
+        [&value, field] (const DeviceBox::SourceConfig& source) {
+            value = source.*field;
+        });
+
+    return value;
+}
+
+}
+
+UNIT_TEST(DeviceBoxConfigUpdate)
+{
+    using DeviceBox::SourceConfig;
+
+    Protocol::ClientConfig initialConfig;
+    AddSource(&initialConfig, "unchanged", "rtsp://unchanged");
+    AddSource(&initialConfig, "changed", "rtsp://changed");
+    AddSource(&initialConfig, "removed", "rtsp://removed");
+    initialConfig.mutable_dropbox()->set_token("token");
+
+    DeviceBox::Config config;
+    config.loadConfig(initialConfig);
+    CHECK(!config.empty());
+    CHECK("token" == config.dropboxToken());
+
+    const std::string unchangedArchivePath =
+        SourceField(&config, "unchanged", &SourceConfig::archivePath);
+    CHECK(!unchangedArchivePath.empty());
+
+    Protocol::ClientConfig updatedConfig;
+    AddSource(&updatedConfig, "unchanged", "rtsp://unchanged");
+    AddSource(&updatedConfig, "changed", "rtsp://changed/2");
+    AddSource(&updatedConfig, "added", "rtsp://added");
+    // only first source with the same id is used
+    AddSource(&updatedConfig, "added", "rtsp://added/2");
+
+    std::vector<std::string> stoppedSources;
+    std::vector<std::string> startedSources;
+    config.updateConfig(updatedConfig, &stoppedSources, &startedSources);
+
+    CHECK(2 == stoppedSources.size());
+    CHECK(Contains(stoppedSources, "changed"));
+    CHECK(Contains(stoppedSources, "removed"));
+
+    CHECK(2 == startedSources.size());
+    CHECK(Contains(startedSources, "changed"));
+    CHECK(Contains(startedSources, "added"));
+
+    // unchanged source keeps running with the same config
+    CHECK(unchangedArchivePath == SourceField(&config, "unchanged", &SourceConfig::archivePath));
+    CHECK("rtsp://changed/2" == SourceField(&config, "changed", &SourceConfig::uri));
+    CHECK("rtsp://added" == SourceField(&config, "added", &SourceConfig::uri));
+    CHECK(!config.findSource("removed", [] (const SourceConfig&) {}));
+
+    // dropbox config missing in update means dropbox is disabled
+    CHECK(config.dropboxToken().empty());
+
+    stoppedSources.clear();
+    startedSources.clear();
+    config.updateConfig(updatedConfig, &stoppedSources, &startedSources);
+    CHECK(stoppedSources.empty());
+    CHECK(startedSources.empty());
+
+    config.updateConfig(Protocol::ClientConfig(), &stoppedSources, &startedSources);
+    CHECK(3 == stoppedSources.size());
+    CHECK(startedSources.empty());
+    CHECK(config.empty());
+}
@@ -0,0 +1,86 @@
+#include <thread>
+
+#include "Common/LruCache.h"
+#include "Server/Config/CredentialsCache.h"
+
+#include "Check.h"
+
+
+UNIT_TEST(LruCacheEviction)
+{
+    LruCache<int, int> cache(3, std::chrono::hours(1));
+    CHECK(cache.empty());
+
+    cache.put(1, 10);
+    cache.put(2, 20);
+    cache.put(3, 30);
+    CHECK(3 == cache.size());
+
+    // makes 1 most recently used, so 2 is evicted next
+    CHECK(cache.find(1) && 10 == *cache.find(1));
+
+    cache.put(4, 40);
+    CHECK(3 == cache.size());
+    CHECK(!cache.find(2));
+    CHECK(cache.find(1) && cache.find(3) && cache.find(4));
+
+    // update of existing entry doesn't evict anything
+    cache.put(3, 33);
+    CHECK(3 == cache.size());
+    CHECK(cache.find(3) && 33 == *cache.find(3));
+
+    cache.erase(3);
+    CHECK(!cache.find(3));
+    CHECK(2 == cache.size());
+
+    cache.clear();
+    CHECK(cache.empty());
+    CHECK(!cache.find(1));
+}
+
+UNIT_TEST(LruCacheTtl)
+{
+    LruCache<int, int> cache(10, std::chrono::milliseconds(100));
+
+    cache.put(1, 10);
+    CHECK(cache.find(1));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    cache.put(2, 20);
+    // refreshes entry lifetime
+    cache.put(1, 11);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    CHECK(cache.find(1) && 11 == *cache.find(1));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(120));
+    CHECK(!cache.find(1));
+    CHECK(!cache.find(2));
+    // expired entries are dropped on lookup
+    CHECK(cache.empty());
+}
+
+UNIT_TEST(CredentialsCacheGeneration)
+{
+    Server::Config::CredentialsCache cache;
+
+    const unsigned generation = cache.generation();
+    CHECK(!cache.find("user", "password"));
+
+    cache.put(generation, "user", "password");
+    CHECK(cache.find("user", "password"));
+    CHECK(!cache.find("user", "wrong password"));
+    CHECK(!cache.find("another user", "password"));
+    // user name and password boundary is not ambiguous
+    CHECK(!cache.find("userp", "assword"));
+
+    cache.invalidate();
+    CHECK(!cache.find("user", "password"));
+
+    // credentials checked against outdated config are not cached
+    cache.put(generation, "user", "password");
+    CHECK(!cache.find("user", "password"));
+
+    cache.put(cache.generation(), "user", "password");
+    CHECK(cache.find("user", "password"));
+}
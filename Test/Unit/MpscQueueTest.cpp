@@ -0,0 +1,102 @@
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "Common/MpscQueue.h"
+
+#include "Check.h"
+
+
+UNIT_TEST(MpscQueueFull)
+{
+    // rounded up to 8
+    MpscQueue<int> queue(5);
+
+    int value = 0;
+    CHECK(!queue.pop(&value));
+
+    for(int i = 0; i < 8; ++i)
+        CHECK(queue.push(int(i)));
+    CHECK(!queue.push(8));
+
+    CHECK(queue.pop(&value) && 0 == value);
+    // freed cell is reusable
+    CHECK(queue.push(8));
+    CHECK(!queue.push(9));
+
+    for(int i = 1; i <= 8; ++i)
+        CHECK(queue.pop(&value) && i == value);
+    CHECK(!queue.pop(&value));
+}
+
+UNIT_TEST(MpscQueueWraparound)
+{
+    MpscQueue<std::string> queue(4);
+
+    // one item is always left behind,
+    // so positions go around the ring not aligned to its start
+    unsigned pushed = 0;
+    unsigned popped = 0;
+    CHECK(queue.push(std::to_string(pushed++)));
+
+    std::string value;
+    for(unsigned round = 0; round < 1000; ++round) {
+        for(unsigned i = 0; i < 3; ++i)
+            CHECK(queue.push(std::to_string(pushed++)));
+        CHECK(!queue.push(std::string()));
+
+        for(unsigned i = 0; i < 3; ++i) {
+            CHECK(queue.pop(&value) && std::to_string(popped) == value);
+            ++popped;
+        }
+    }
+
+    CHECK(queue.pop(&value) && std::to_string(popped) == value);
+    CHECK(!queue.pop(&value));
+}
+
+UNIT_TEST(MpscQueueProducers)
+{
+    enum {
+        PRODUCERS = 4,
+        ITEMS_PER_PRODUCER = 100000,
+    };
+
+    MpscQueue<std::pair<unsigned, unsigned>> queue(64);
+
+    std::vector<std::thread> producers;
+    for(unsigned producer = 0; producer < PRODUCERS; ++producer) {
+        producers.emplace_back(
+            [&queue, producer] () {
+                for(unsigned i = 0; i < ITEMS_PER_PRODUCER; ++i) {
+                    while(!queue.push(std::make_pair(producer, i)))
+                        std::this_thread::yield();
+                }
+            });
+    }
+
+    // every producer's items come in order, none is lost or duplicated
+    std::vector<unsigned> expected(PRODUCERS, 0);
+    unsigned received = 0;
+    bool ordered = true;
+    std::pair<unsigned, unsigned> item;
+    while(received < PRODUCERS * ITEMS_PER_PRODUCER) {
+        if(!queue.pop(&item)) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        if(item.first >= PRODUCERS || item.second != expected[item.first])
+            ordered = false;
+        else
+            ++expected[item.first];
+
+        ++received;
+    }
+
+    for(std::thread& producer: producers)
+        producer.join();
+
+    CHECK(ordered);
+    CHECK(!queue.pop(&item));
+}
@@ -0,0 +1,61 @@
+#include <algorithm>
+
+#include "DeviceBox/ReconnectBackoff.h"
+
+#include "Check.h"
+
+
+UNIT_TEST(ReconnectBackoffBounds)
+{
+    enum {
+        MIN_DELAY = 1000, // milliseconds
+        MAX_DELAY = 30000, // milliseconds
+        ATTEMPTS = 1000,
+    };
+
+    DeviceBox::ReconnectBackoff backoff(MIN_DELAY, MAX_DELAY);
+
+    std::chrono::milliseconds::rep previous = MIN_DELAY;
+    std::chrono::milliseconds::rep longest = 0;
+    for(unsigned i = 0; i < ATTEMPTS; ++i) {
+        const std::chrono::milliseconds::rep delay = backoff.next().count();
+
+        CHECK(delay >= MIN_DELAY);
+        CHECK(delay <= MAX_DELAY);
+        // grows at most 3 times per attempt
+        CHECK(delay <= 3 * previous);
+
+        previous = delay;
+        longest = std::max(longest, delay);
+    }
+
+    // not stuck near lower bound
+    CHECK(longest > MAX_DELAY / 2);
+
+    backoff.reset();
+    const std::chrono::milliseconds::rep delay = backoff.next().count();
+    CHECK(delay >= MIN_DELAY && delay <= 3 * MIN_DELAY);
+}
+
+UNIT_TEST(ReconnectBackoffRetryAfter)
+{
+    enum {
+        MIN_DELAY = 1000, // milliseconds
+        MAX_DELAY = 30000, // milliseconds
+        RETRY_AFTER = 60, // seconds
+    };
+
+    DeviceBox::ReconnectBackoff backoff(MIN_DELAY, MAX_DELAY);
+
+    // server's hint wins over backoff even above its upper bound
+    backoff.retryAfter(RETRY_AFTER);
+    CHECK(RETRY_AFTER * 1000 == backoff.next().count());
+
+    // and is used only once
+    CHECK(backoff.next().count() <= MAX_DELAY);
+
+    // hint is about connection which is established already
+    backoff.retryAfter(RETRY_AFTER);
+    backoff.reset();
+    CHECK(backoff.next().count() <= 3 * MIN_DELAY);
+}
@@ -0,0 +1,62 @@
+#include <map>
+
+#include "Server/ControlServer/TimerWheel.h"
+
+#include "Check.h"
+
+
+UNIT_TEST(TimerWheelCascade)
+{
+    using ControlServer::TimerWheel;
+
+    asio::io_service ioService;
+    TimerWheel wheel(&ioService);
+
+    unsigned long currentTick = 0;
+    // expected tick -> tick callback was called on
+    std::map<unsigned long, unsigned long> fired;
+    auto schedule =
+        [&] (unsigned long ticks) {
+            const unsigned long expected = currentTick + ticks;
+            wheel.schedule(
+                std::chrono::milliseconds(ticks * TimerWheel::TICK),
+                [&fired, &currentTick, expected] () {
+                    fired[expected] = currentTick;
+                });
+        };
+
+    const unsigned long level1 = TimerWheel::SLOTS;
+    const unsigned long level2 = TimerWheel::SLOTS * TimerWheel::SLOTS;
+
+    schedule(1);
+    schedule(level1 - 1);
+    schedule(level1);
+    schedule(level1 + 44);
+    schedule(level2 - 1);
+    schedule(level2);
+    schedule(level2 + level1 + 7);
+    CHECK(7 == wheel.size());
+
+    // zero delay is rounded up to one tick
+    wheel.schedule(std::chrono::milliseconds(0), [&fired, &currentTick] () {
+        fired[0] = currentTick;
+    });
+
+    const unsigned long lastTick = level2 + level1 + 7;
+    for(; currentTick < lastTick;) {
+        ++currentTick;
+        wheel.advance();
+
+        // scheduled while wheel is already in motion and lands across wraparound
+        if(200 == currentTick)
+            schedule(level1 - 1);
+    }
+
+    CHECK(0 == wheel.size());
+    CHECK(9 == fired.size());
+    CHECK(1 == fired[0]);
+    for(const auto& expectedAndFired: fired) {
+        if(expectedAndFired.first)
+            CHECK(expectedAndFired.first == expectedAndFired.second);
+    }
+}
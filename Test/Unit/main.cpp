@@ -0,0 +1,45 @@
+#include <cstdio>
+
+#include "Check.h"
+
+
+namespace UnitTest
+{
+
+static unsigned Failures = 0;
+
+std::vector<Test>& Tests()
+{
+    static std::vector<Test> tests;
+    return tests;
+}
+
+void Fail(const char* file, int line, const char* condition)
+{
+    ++Failures;
+    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, condition);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    using namespace UnitTest;
+
+    unsigned failedTests = 0;
+    for(const Test& test: Tests()) {
+        const unsigned failures = Failures;
+
+        test.run();
+
+        const bool passed = failures == Failures;
+        if(!passed)
+            ++failedTests;
+
+        std::fprintf(stderr, "[%s] %s\n", passed ? "PASSED" : "FAILED", test.name);
+    }
+
+    std::fprintf(stderr, "%zu tests, %u failed\n", Tests().size(), failedTests);
+
+    return failedTests ? 1 : 0;
+}